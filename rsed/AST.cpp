@@ -33,13 +33,11 @@ public:
 };
 }
 
-int AST::next_id = 0;
-int RegExPattern::nextIndex = 0;
 const char *const AST::CURRENT_LINE_SYM = "CURRENT";
 
 void AST::dump() const {
   Dumper d(std::cout);
-  std::cout << "style " << RegEx::getStyleName() << '\n';
+  std::cout << "style " << Context::current()->regEx->getStyleName() << '\n';
   if (isStatement()) {
     d.dump(0, (Statement *)this);
   } else {
@@ -116,12 +114,15 @@ void Dumper::dumpOneStmt(int depth, const Statement *node, bool elseIf) {
     break;
   }
   case AST::SetAppendN:
+  case AST::SetConcatN:
   case AST::SetN: {
     auto s = static_cast<const Set *>(node);
     indent(depth);
     if (s->lhs) {
       if (s->kind() == s->SetAppendN) {
         OS << "append ";
+      } else if (s->kind() == s->SetConcatN) {
+        OS << "concat ";
       }
       dumpExpr(s->lhs);
       OS << " = ";
@@ -295,7 +296,12 @@ void Dumper::dumpExpr(const Expression *node) {
   switch (node->kind()) {
   case AST::BinaryN: {
     auto b = static_cast<const Binary *>(node);
-    if (b->left) {
+    if (b->isOp(b->SUBSCRIPT) && b->left->kind() == AST::BinaryN) {
+      // a subscript of a parenthesized expression
+      OS << '(';
+      dumpExpr(b->left);
+      OS << ')';
+    } else if (b->left) {
       dumpExpr(b->left);
     }
     switch (b->op) {
@@ -389,6 +395,19 @@ void Dumper::dumpExpr(const Expression *node) {
     OS << ')';
     break;
   }
+  case AST::MapN: {
+    OS << (ListP(node)->head ? "{" : "{:");
+    for (auto a = ListP(node)->head; a; a = a->nextArg->nextArg) {
+      dumpExpr(a->value);
+      OS << ": ";
+      dumpExpr(a->nextArg->value);
+      if (a->nextArg->nextArg) {
+        OS << ", ";
+      }
+    }
+    OS << '}';
+    break;
+  }
   case AST::RegExPatternN: {
     auto r = static_cast<const RegExPattern *>(node);
     OS << "regex[" << r->getIndex() << ",";
@@ -443,6 +462,7 @@ Value::Kind Expression::valueKind() {
   case AST::RegExPatternN:
   case AST::ControlN:
   case AST::ListN:
+  case AST::MapN:
     return Value::String;
   case AST::CallN:
     return BuiltinCalls::callKind(((Call *)this)->getCallId());
@@ -485,6 +505,90 @@ Value::Kind Expression::valueKind() {
   }
 }
 
+bool Expression::staticKind(Value::Kind *k) {
+  switch (kind()) {
+  case AST::StringConstN:
+  case AST::VarMatchN:
+    *k = Value::String;
+    return true;
+  case AST::NumberN:
+    *k = Value::Number;
+    return true;
+  case AST::LogicalN:
+    *k = Value::Logical;
+    return true;
+  case AST::RegExPatternN:
+    *k = Value::RegEx;
+    return true;
+  case AST::ListN:
+    *k = Value::List;
+    return true;
+  case AST::MapN:
+    *k = Value::Map;
+    return true;
+  case AST::CallN:
+    *k = BuiltinCalls::callKind(((Call *)this)->getCallId());
+    return true;
+  case AST::VariableN:
+    return ((Variable *)this)->getKind(k);
+  case AST::HoistedValueRefN:
+    return ((HoistedValueRef *)this)->value->staticKind(k);
+  case AST::LiatEltN:
+  case AST::ControlN:
+    return false;
+  case AST::BinaryN:
+    switch (((Binary *)this)->op) {
+    case Binary::ADD:
+    case Binary::SUB:
+    case Binary::MUL:
+    case Binary::DIV:
+    case Binary::NEG:
+      *k = Value::Number;
+      return true;
+    case Binary::LT:
+    case Binary::LE:
+    case Binary::EQ:
+    case Binary::NE:
+    case Binary::GE:
+    case Binary::GT:
+    case Binary::NOT:
+    case Binary::AND:
+    case Binary::OR:
+    case Binary::MATCH:
+      *k = Value::Logical;
+      return true;
+    case Binary::REPLACE:
+    case Binary::SET_GLOBAL:
+      *k = Value::String;
+      return true;
+    case Binary::SPLIT_REG:
+    case Binary::SPLIT_COLS:
+    case Binary::MATCHES:
+      *k = Value::List;
+      return true;
+    case Binary::CONCAT: {
+      // lists are joined only when every term is a list
+      bool allLists = true, someString = false;
+      walkConcat([&allLists, &someString](Expression *t) {
+        Value::Kind tk;
+        if (!t->staticKind(&tk)) {
+          allLists = false;
+        } else if (tk != Value::List) {
+          allLists = false;
+          someString = true;
+        }
+      });
+      *k = (allLists ? Value::List : Value::String);
+      return allLists || someString;
+    }
+    case Binary::LOOKUP:
+    case Binary::SUBSCRIPT:
+      return false;
+    }
+  }
+  return false;
+}
+
 Expression *AST::checkPattern(Expression *pattern) {
   if (auto n = pattern->isOp(Expression::NOT)) {
     n->right = checkPattern(n->right);
@@ -505,7 +609,7 @@ public:
   }
   StringConst *makeString(std::string s, unsigned flags) {
     if (flags & StringRef::ESCAPE_SPECIALS) {
-      s = RegEx::regEx->escape(s);
+      s = Context::current()->regEx->escape(s);
     }
     return new StringConst(StringRef(std::move(s), flags));
   }
@@ -15,6 +15,7 @@
 #include "StringRef.h"
 #include "Value.h"
 #include "BuiltinCalls.h"
+#include "Context.h"
 
 class Statement;
 class Expression;
@@ -23,7 +24,6 @@ class AST {
 protected:
   int id;
   int sourceLine;
-  static int next_id;
 
 public:
   void dump() const;
@@ -32,7 +32,8 @@ public:
   enum StopKind { StopAfter, StopAt };
   int getSourceLine() const { return sourceLine; }
 
-  AST(int sourceLine) : id(++next_id), sourceLine(sourceLine) {}
+  AST(int sourceLine)
+      : id(++Context::current()->nextId), sourceLine(sourceLine) {}
 
   static Statement *foreach (Expression *control, Statement * body,
                              int sourceLine);
@@ -65,6 +66,7 @@ public:
     IfStmtN,
     SetN,
     SetAppendN,
+    SetConcatN,
     ColumnsN,
     PrintN,
     StopN,
@@ -83,6 +85,7 @@ public:
     StringConstN,
     CallN,
     ListN,
+    MapN,
     LiatEltN,
     BinaryN,
     RegExPatternN,
@@ -172,6 +175,9 @@ public:
   const BinaryP isOp(Operators op) const;
   static const char *opName(Operators op);
   Value::Kind valueKind();
+  // the kind of every value of this expression, when it is known before
+  // the script runs
+  bool staticKind(Value::Kind *kind);
   class Call * isCall(BuiltinCalls::Builtins id) ;
 };
 
@@ -310,12 +316,23 @@ public:
 
 class Variable : public Expression {
   Symbol &symbol;
+  // the kind of the variable at this use, found by kind inference
+  bool hasKind = false;
+  Value::Kind inferredKind;
 
 public:
   Variable(Symbol &symbol) : symbol(symbol) {}
   ExprKind kind() const override { return VariableN; }
   const std::string &getName() const { return symbol.getName(); }
   Symbol &getSymbol() const { return symbol; }
+  void setKind(bool known, Value::Kind kind = Value::String) {
+    hasKind = known;
+    inferredKind = kind;
+  }
+  bool getKind(Value::Kind *kind) const {
+    *kind = inferredKind;
+    return hasKind;
+  }
   bool same(Expression *e) {
     return e->kind() == VariableN && &((Variable *)e)->getSymbol() == &symbol;
   }
@@ -347,11 +364,12 @@ class StringConst : public Expression {
   StringRef constant;
 
 public:
-  StringConst(StringRef constant) : constant(constant) {}
-  StringConst(const char *constant) : constant(std::string(constant),0) {}
+  StringConst(StringRef constant) : constant(constant.intern()) {}
+  StringConst(const char *constant)
+      : constant(StringRef(constant).intern()) {}
   ExprKind kind() const override { return StringConstN; }
   const StringRef &getConstant() const { return constant; }
-  void setConstant(StringRef constant) { this->constant = constant; }
+  void setConstant(StringRef constant) { this->constant = constant.intern(); }
 };
 
 class Number : public Expression {
@@ -401,6 +419,15 @@ public:
 };
 typedef SetAppend *SetAppendP;
 
+// for x = $x ....
+class SetConcat : public Set {
+public:
+  SetConcat(Set *set) : Set(set->lhs, set->rhs, set->getSourceLine()) {}
+  static StmtKind typeKind() { return SetConcatN; }
+  StmtKind kind() const override { return typeKind(); }
+};
+typedef SetConcat *SetConcatP;
+
 class Print : public Statement {
 public:
   Expression *text;
@@ -487,6 +514,13 @@ public:
 };
 typedef List *ListP;
 
+// a map literal, the arguments alternate keys and values
+class Map : public List {
+public:
+  Map(ListElt *head) : List(head) {}
+  ExprKind kind() const override { return MapN; }
+};
+
 class Call : public List {
   std::string name;
   unsigned callId;
@@ -509,12 +543,11 @@ inline Call * Expression::isCall(BuiltinCalls::Builtins id) {
 // where we compiler a regular expression
 class RegExPattern : public Expression {
   int index;
-  static int nextIndex;
 
 public:
   Expression *pattern;
   RegExPattern(Expression *pattern, int index = -1)
-      : Expression(pattern->getSourceLine()), index(nextIndex++),
+      : Expression(pattern->getSourceLine()), index(Context::current()->nextPattern++),
         pattern(pattern) {}
   ExprKind kind() const override { return RegExPatternN; }
   void setIndex(int index) { this->index = index; };
@@ -29,9 +29,12 @@ template <typename ACTION> AST::WalkResult Statement::walk(const ACTION &a) {
 
     case IfStmtN: {
       auto ifs = (IfStatement *)s;
-      rc = ifs->thenStmts->walk(a);
-      if (rc == StopW)
-        return rc;
+      // an empty branch is null
+      if (auto thenStmts = ifs->thenStmts) {
+        rc = thenStmts->walk(a);
+        if (rc == StopW)
+          return rc;
+      }
       if (rc == ContinueW) {
         if (auto elseStmts = ifs->elseStmts) {
           rc = elseStmts->walk(a);
@@ -84,6 +87,7 @@ AST::WalkResult Statement::walkExprs(const ACTION &a) {
     break;
   case SetN:
   case SetAppendN:
+  case SetConcatN:
     rc = ((Set *)this)->rhs->walkDown(a);
     break;
   case IfStmtN:
@@ -144,12 +148,15 @@ void Statement::applyExprs(bool recurseIntoForeach, const ACTION &a) {
     break;
   case SetN:
   case SetAppendN:
+  case SetConcatN:
     a(((Set *)this)->rhs);
     break;
   case IfStmtN: {
     auto ifs = (IfStatement *)this;
     a(ifs->predicate);
-    ifs->thenStmts->applyExprs(recurseIntoForeach, a);
+    if (ifs->thenStmts) {
+      ifs->thenStmts->applyExprs(recurseIntoForeach, a);
+    }
     if (ifs->elseStmts) {
       ifs->elseStmts->applyExprs(recurseIntoForeach, a);
     }
@@ -182,7 +189,9 @@ template <typename ACTION> AST::WalkResult Expression::walkUp(const ACTION &a) {
   switch (e->kind()) {
   case ControlN: {
     auto c = (Control *)e;
-    rc = c->pattern->walkUp(a);
+    if (c->pattern) {
+      rc = c->pattern->walkUp(a);
+    }
     if (rc == ContinueW && c->errorMsg) {
       rc = c->errorMsg->walkUp(a);
     }
@@ -198,6 +207,7 @@ template <typename ACTION> AST::WalkResult Expression::walkUp(const ACTION &a) {
     break;
   case CallN:
   case ListN:
+  case MapN:
     for (auto arg = CallP(e)->head; arg; arg = arg->nextArg) {
       rc = arg->value->walkUp(a);
       if (rc != ContinueW)
@@ -237,9 +247,11 @@ AST::WalkResult Expression::walkDown(const ACTION &a) {
   switch (e->kind()) {
   case ControlN: {
     auto c = (Control *)e;
-    rc = c->pattern->walkDown(a);
-    if (rc != ContinueW)
-      return rc;
+    if (c->pattern) {
+      rc = c->pattern->walkDown(a);
+      if (rc != ContinueW)
+        return rc;
+    }
     if (c->errorMsg) {
       rc = c->errorMsg->walkDown(a);
     }
@@ -257,6 +269,7 @@ AST::WalkResult Expression::walkDown(const ACTION &a) {
     break;
   case CallN:
   case ListN:
+  case MapN:
     for (auto arg = ListP(e)->head; arg; arg = arg->nextArg) {
       rc = arg->value->walkDown(a);
       if (rc != ContinueW)
@@ -40,9 +40,16 @@ vector<BuiltinName> builtins{{LENGTH, "length"},
                              {NUMBERB, "number"},
                              {STRINGB, "string"},
                              {APPEND, "append"},
+                             {KEYS, "keys"},
+                             {VALUES, "values"},
+                             {INTERN, "intern"},
                              {SHELL, "shell"}};
 
-string doQuote(char quote, const string &text) {
+void write(std::ostream &ss, const StringRef &s) {
+  ss.write(s.data(), s.length());
+}
+
+string doQuote(char quote, const StringRef &text) {
   string result;
   result.append(1, quote);
   for (auto c : text) {
@@ -63,6 +70,10 @@ Value::Kind callKind(unsigned id) {
     return Value::Number;
   case LOGICAL:
     return Value::Logical;
+  case APPEND:
+  case KEYS:
+  case VALUES:
+    return Value::List;
   default:
     return Value::String;
   }
@@ -89,10 +100,11 @@ bool getCallId(const string &name, unsigned *u) {
   return false;
 }
 
-StringPtr shell(vector<Value *> &args) {
+StringRef shell(vector<Value *> &args) {
   std::stringstream ss;
   for (auto v : args) {
-    ss << v->asString().getText() << " ";
+    write(ss, v->asString());
+    ss << " ";
   }
   std::string shellCmd = ss.str();
   auto pipe = LineBuffer::makePipeBuffer(shellCmd);
@@ -109,7 +121,7 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
   case TRIM: {
     const std::string &delimiters = " \f\n\r\t\v";
     for (auto &sr : args) {
-      string s = sr->asString().getText();
+      string s = sr->asString().str();
       s.erase(s.find_last_not_of(delimiters) + 1);
       s.erase(0, s.find_first_not_of(delimiters));
       ss << s;
@@ -122,9 +134,11 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
       auto first = args.front();
       if (first->isList()) {
         len = first->listLength();
+      } else if (first->isMap()) {
+        len = first->getMap().size();
       }
       else {
-        len = first->asString().getText().length();
+        len = first->asString().length();
       }
     }
     result->set(len);
@@ -134,18 +148,18 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
     if (args.size() < 2) {
       break;
     }
-    auto sep = args[0]->asString().getText();
+    auto sep = args[0]->asString();
     bool first = true;
     auto append = [&first, &ss, sep](Value *v) {
       if (!first) {
-        ss << sep;
+        write(ss, sep);
       } else
         first = false;
-      ss << v->asString().getText();
+      write(ss, v->asString());
     };
     for (auto i = 1; i < args.size(); i++) {
       if (args[i]->kind == Value::List) {
-        for (auto &v : args[i]->list) {
+        for (auto &v : args[i]->getList()) {
           append(&v);
         }
       } else {
@@ -156,7 +170,7 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
   }
   case ESCAPE:
     for (auto &str : args) {
-      ss << state->getRegEx()->escape(str->asString().getText());
+      ss << state->getRegEx()->escape(str->asString().str());
     }
     break;
 
@@ -165,27 +179,27 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
     auto ap = args.begin();
     if (args.size() > 1) {
       auto &q = *ap++;
-      if (q->asString().getText().empty()) {
+      if (q->asString().empty()) {
         throw Exception("empty quote specification in quote()");
       }
-      quote = q->asString().getText()[0];
+      quote = q->asString()[0];
     }
     auto end = args.end();
     for (; ap != end; ++ap) {
-      ss << doQuote(quote, (*ap)->asString().getText());
+      ss << doQuote(quote, (*ap)->asString());
     }
     break;
   }
   case MKTEMP: {
-    static char buffer[] = "rsedXXXXXX";
+    char buffer[] = "rsedXXXXXX";
     auto t = ::mktemp(buffer);
-    LineBuffer::tempFileNames.emplace_back(t);
+    LineBuffer::addTempFile(t);
     ss << t;
     break;
   }
   case EXPAND:
     for (auto a : args) {
-      state->expandVariables(a->asString().getText(), ss);
+      state->expandVariables(a->asString().str(), ss);
     }
     break;
   case SHELL:
@@ -199,20 +213,22 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
       result->setString(args[0]);
       return;
     }
-    const auto &text = args[0]->asString().getText();
+    const auto &text = args[0]->asString();
+    int length = text.length();
     auto start = (int)args[1]->asNumber();
     if (start < 0) {
-      start = std::max(0, int(text.length() + start));
+      start = std::max(0, length + start);
     }
+    start = std::min(start, length);
+    auto count = length - start;
     if (n > 2) {
       auto len = (int)args[2]->asNumber();
       if (len < 0) {
         throw Exception("negative length value for substring");
       }
-      result->set(text.substr(start, len));
-      return;
+      count = std::min(len, count);
     }
-    result->set(text.substr(start));
+    result->set(text.slice(start, count));
     return;
   }
   case IFNULL: {
@@ -220,9 +236,9 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
       throw Exception("at least two args required for ifnull()");
     }
     for (auto v : args) {
-      auto s = v->asString().getText();
-      if (s != "") {
-        ss << s;
+      auto &s = v->asString();
+      if (!s.empty()) {
+        write(ss, s);
         break;
       }
     }
@@ -248,10 +264,38 @@ void evalCall(unsigned int id, vector<Value *> &args, EvalState *state,
       return;
     }
     for (auto v : args) {
-      ss << v->asString().getText();
+      write(ss, v->asString());
     }
     break;
   }
+  case KEYS:
+  case VALUES: {
+    // the keys or values of maps, in insertion order
+    result->clearList();
+    for (auto v : args) {
+      if (!v->isMap()) {
+        throw Exception(string(id == KEYS ? "keys" : "values") +
+                        "() requires map arguments");
+      }
+      for (auto &e : v->getMap().getEntries()) {
+        if (id == KEYS) {
+          result->listAppend(e.key);
+        } else {
+          result->append(e.value);
+        }
+      }
+    }
+    return;
+  }
+  case INTERN: {
+    // a shared copy of a low cardinality value, == against other interned
+    // strings (including constants) is then a pointer compare
+    if (args.empty()) {
+      break;
+    }
+    result->set(args[0]->asString().intern());
+    return;
+  }
   case APPEND: {
     // TODO does APPEND flatten? or only sort-of flatten?
     //   if it changes, also change printListElt in interpret.cpp
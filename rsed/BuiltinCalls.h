@@ -29,6 +29,9 @@ enum Builtins {
   NUMBERB,
   STRINGB,
   APPEND,
+  KEYS,
+  VALUES,
+  INTERN,
 };
 bool getCallId(const std::string &name, unsigned *);
 void evalCall(unsigned id, std::vector<Value *> &args, EvalState *,
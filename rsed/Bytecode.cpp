@@ -0,0 +1,886 @@
+//
+//  Bytecode.cpp
+//  rsed
+//
+
+#include "Bytecode.h"
+#include <assert.h>
+#include <iostream>
+#include <unordered_map>
+#include <gflags/gflags.h>
+#include "AST.h"
+#include "ASTWalk.h"
+#include "Symbol.h"
+#include "Context.h"
+
+DECLARE_bool(optimize);
+
+namespace Bytecode {
+
+namespace {
+const char *const opcodeNames[] = {
+#define RSED_OPCODE_NAME(name) #name,
+    RSED_OPCODES(RSED_OPCODE_NAME)
+#undef RSED_OPCODE_NAME
+};
+
+bool usesSymbol(Opcode op) {
+  switch (op) {
+  case LOAD_VAR:
+  case SUBSCRIPT_VAR:
+  case SET_VAR:
+  case SET_SUBSCRIPT:
+  case IF_NOT_LIST:
+  case LIST_APPEND:
+  case IF_NOT_STRING:
+  case APPEND_STRING:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// every value of 'e' has 'kind'
+bool isKind(Expression *e, Value::Kind kind) {
+  Value::Kind k;
+  return e->staticKind(&k) && k == kind;
+}
+
+// the same variable or match variable
+bool sameSubject(Expression *a, Expression *b) {
+  if (a->kind() != b->kind()) {
+    return false;
+  }
+  if (a->kind() == AST::VariableN) {
+    return &((Variable *)a)->getSymbol() == &((Variable *)b)->getSymbol();
+  }
+  return ((VarMatch *)a)->getValue() == ((VarMatch *)b)->getValue();
+}
+
+// recognize 'subject == constant', in either order, where the equality
+// is a compare of strings: the constant is a string or the subject is
+// always one. Sets the subject and the constant's text.
+bool switchCase(Expression *p, Expression **subject, StringRef *key) {
+  if (p->kind() != AST::BinaryN || !((Binary *)p)->isOp(Binary::EQ)) {
+    return false;
+  }
+  auto b = (Binary *)p;
+  auto s = b->left, c = b->right;
+  if (s->kind() == AST::StringConstN || s->kind() == AST::NumberN) {
+    std::swap(s, c);
+  }
+  if (s->kind() != AST::VariableN && s->kind() != AST::VarMatchN) {
+    return false;
+  }
+  if (c->kind() == AST::StringConstN) {
+    *key = ((StringConst *)c)->getConstant();
+  } else if (c->kind() == AST::NumberN && isKind(s, Value::String)) {
+    Value v(((Number *)c)->getValue());
+    *key = v.asString().intern();
+  } else {
+    return false;
+  }
+  *subject = s;
+  return true;
+}
+
+class Compiler {
+  Program *program;
+  std::unordered_map<Expression *, unsigned> registers;
+  std::unordered_map<Symbol *, unsigned> symbols;
+  // the statement being compiled, reported by errors in its instructions
+  Statement *current = nullptr;
+
+  // the innermost foreach: its state slot and the jumps to its next
+  // iteration, which are resolved once the body is compiled
+  struct Loop {
+    unsigned slot;
+    std::vector<unsigned> nextJumps;
+  };
+  Loop *innermost = nullptr;
+
+  unsigned here() const { return program->code.size(); }
+  Instruction &at(unsigned pc) { return program->code[pc]; }
+  unsigned emit(Opcode op, unsigned a = NONE, unsigned b = NONE,
+                unsigned c = NONE, unsigned d = NONE) {
+    program->code.emplace_back(op, a, b, c, d);
+    program->source.push_back(current);
+    return here() - 1;
+  }
+  unsigned emit(Opcode op, Symbol *symbol, unsigned a = NONE,
+                unsigned b = NONE) {
+    return emit(op, a, b, NONE, symbolIndex(symbol));
+  }
+  unsigned symbolIndex(Symbol *symbol) {
+    auto it = symbols.find(symbol);
+    if (it != symbols.end()) {
+      return it->second;
+    }
+    unsigned i = program->symbols.size();
+    program->symbols.push_back(symbol);
+    symbols[symbol] = i;
+    return i;
+  }
+  // start an operand list, returns its start; the count is the number of
+  // operands added since
+  unsigned operands() const { return program->operands.size(); }
+  unsigned count(unsigned start) const { return operands() - start; }
+
+  unsigned reg(Expression *e);
+  unsigned expr(Expression *e);
+  unsigned binary(Binary *b);
+  unsigned list(Expression *head, Opcode op, Expression *e);
+  unsigned words(Expression *e, unsigned r, Expression *index);
+  unsigned columns(Expression *inExpr, Expression *cols, Opcode op,
+                   unsigned dst);
+  unsigned patternRegister(Expression *e);
+  void requiredFailure(Expression *predicate, Expression *errMsg, bool atEof);
+
+  void statements(Statement *list);
+  void statement(Statement *stmt);
+  bool switchChain(IfStatement *chain);
+  void loop(Foreach *foreach);
+  bool kernel(Foreach *foreach);
+  unsigned invariant(Expression *e);
+  void set(Set *set);
+  void print(Expression *e);
+  void printListElt(Expression *e, unsigned sep, bool first);
+  void next();
+
+public:
+  Compiler(Program *program) : program(program) {}
+  void compile(Statement *script) {
+    statements(script);
+    emit(HALT);
+  }
+};
+
+// every expression node has a register, uses of a hoisted value share
+// the register of the hoisted expression
+unsigned Compiler::reg(Expression *e) {
+  while (e->kind() == AST::HoistedValueRefN) {
+    e = ((HoistedValueRef *)e)->value;
+  }
+  auto it = registers.find(e);
+  if (it != registers.end()) {
+    return it->second;
+  }
+  unsigned r = program->registers.size();
+  program->registers.emplace_back();
+  registers[e] = r;
+  return r;
+}
+
+// the register holding the pattern text of a regular expression match,
+// used in error messages
+unsigned Compiler::patternRegister(Expression *e) {
+  if (e->kind() == AST::RegExPatternN) {
+    return reg(((RegExPattern *)e)->pattern);
+  }
+  if (e->kind() == AST::HoistedValueRefN) {
+    return patternRegister(((HoistedValueRef *)e)->value);
+  }
+  if (auto b = e->isOp(e->MATCH)) {
+    return patternRegister(b->right);
+  }
+  return NONE;
+}
+
+// emit code to evaluate 'e', returns the register with its value
+unsigned Compiler::expr(Expression *e) {
+  auto r = reg(e);
+  switch (e->kind()) {
+  case AST::LiatEltN:
+  case AST::ControlN:
+    assert(0 && "internal error: unexpected expression");
+    break;
+  case AST::HoistedValueRefN:
+    break;
+  case AST::VariableN:
+    emit(LOAD_VAR, &((Variable *)e)->getSymbol(), r);
+    break;
+  case AST::NumberN:
+    program->registers[r] = Value(((Number *)e)->getValue());
+    break;
+  case AST::LogicalN:
+    program->registers[r] = Value(((Logical *)e)->getValue());
+    break;
+  case AST::StringConstN:
+    program->registers[r] = Value(((StringConst *)e)->getConstant());
+    break;
+  case AST::VarMatchN:
+    emit(LOAD_MATCH, r, (unsigned)((VarMatch *)e)->getValue());
+    break;
+  case AST::CallN: {
+    auto arg = (ListElt *)ListP(e)->head;
+    if (e->isCall(BuiltinCalls::LENGTH) && arg && !arg->nextArg &&
+        words(arg->value, r, nullptr) != NONE) {
+      break;
+    }
+    at(list(ListP(e)->head, CALL, e)).d = ((Call *)e)->getCallId();
+    break;
+  }
+  case AST::ListN:
+    list(ListP(e)->head, LIST, e);
+    break;
+  case AST::MapN:
+    list(ListP(e)->head, MAP, e);
+    break;
+  case AST::RegExPatternN: {
+    auto p = (RegExPattern *)e;
+    emit(PATTERN, r, expr(p->pattern), p->getIndex());
+    break;
+  }
+  case AST::BinaryN:
+    binary((Binary *)e);
+    break;
+  }
+  return r;
+}
+
+// evaluate the elements of a list, call or map and then build it,
+// returns the building instruction
+unsigned Compiler::list(Expression *head, Opcode op, Expression *e) {
+  std::vector<unsigned> elements;
+  for (auto a = (ListElt *)head; a; a = a->nextArg) {
+    elements.push_back(expr(a->value));
+  }
+  auto start = operands();
+  program->operands.insert(program->operands.end(), elements.begin(),
+                           elements.end());
+  return emit(op, reg(e), start, count(start));
+}
+
+// An element (at 'index') or the length (no index) of a split or of the
+// matches of a regex, taken without building the list; a subscript stops
+// searching once it has its element. Returns NONE when 'e' is neither.
+unsigned Compiler::words(Expression *e, unsigned r, Expression *index) {
+  if (!FLAGS_optimize) {
+    return NONE;
+  }
+  if (auto s = e->isOp(Binary::SPLIT_REG)) {
+    auto text = expr(s->left);
+    auto regex = expr(s->right);
+    if (!index) {
+      return emit(SPLIT_LENGTH, r, text, regex);
+    }
+    return emit(SPLIT_AT, r, text, regex, expr(index));
+  }
+  if (auto m = e->isOp(Binary::MATCHES)) {
+    auto pattern = expr(m->right);
+    auto target = expr(m->left);
+    if (!index) {
+      return emit(MATCHES_LENGTH, r, pattern, target);
+    }
+    return emit(MATCHES_AT, r, pattern, target, expr(index));
+  }
+  return NONE;
+}
+
+unsigned Compiler::columns(Expression *inExpr, Expression *cols, Opcode op,
+                           unsigned dst) {
+  auto in = expr(inExpr);
+  std::vector<unsigned> leaves;
+  cols->walkConcat([this, &leaves](Expression *c) { leaves.push_back(expr(c)); });
+  auto start = operands();
+  program->operands.insert(program->operands.end(), leaves.begin(),
+                           leaves.end());
+  return emit(op, dst, start, count(start), in);
+}
+
+// emit code for a binary operator, returns its last instruction
+unsigned Compiler::binary(Binary *b) {
+  auto r = reg(b);
+  switch (b->op) {
+  case Binary::NOT:
+    return emit(NOT, r, expr(b->right));
+  case Binary::NEG:
+    return emit(isKind(b->right, Value::Number) ? NEG_NUM : NEG, r,
+                expr(b->right));
+  case Binary::LOOKUP:
+    return emit(LOOKUP, r, expr(b->right));
+  case Binary::SET_GLOBAL:
+    return emit(SET_GLOBAL, r, expr(b->right));
+  case Binary::CONCAT: {
+    std::vector<unsigned> leaves;
+    b->walkConcat([this, &leaves](Expression *e) { leaves.push_back(expr(e)); });
+    auto start = operands();
+    program->operands.insert(program->operands.end(), leaves.begin(),
+                             leaves.end());
+    return emit(CONCAT, r, start, count(start));
+  }
+  case Binary::MATCH:
+  case Binary::MATCHES: {
+    // the pattern is evaluated before the target
+    auto pattern = expr(b->right);
+    auto target = expr(b->left);
+    return emit(b->op == Binary::MATCH ? MATCH : MATCHES, r, pattern, target);
+  }
+  case Binary::REPLACE: {
+    auto m = (Binary *)b->left;
+    assert(m->isOp(m->MATCH));
+    auto pattern = expr(m->right);
+    auto input = expr(m->left);
+    return emit(REPLACE, r, pattern, input, expr(b->right));
+  }
+  case Binary::SPLIT_REG: {
+    auto text = expr(b->left);
+    return emit(SPLIT, r, text, expr(b->right));
+  }
+  case Binary::SPLIT_COLS:
+    return columns(b->left, b->right, SPLIT_COLUMNS, r);
+  case Binary::AND:
+  case Binary::OR: {
+    // r = logical(left); if it decides the result skip the right side
+    emit(TEST, r, expr(b->left));
+    auto skip = emit(b->op == Binary::AND ? JUMP_IF_FALSE : JUMP_IF_TRUE, r);
+    auto pc = emit(TEST, r, expr(b->right));
+    at(skip).b = here();
+    return pc;
+  }
+  case Binary::SUBSCRIPT: {
+    auto pc = words(b->left, r, b->right);
+    if (pc != NONE) {
+      return pc;
+    }
+    if (b->left->kind() == AST::VariableN) {
+      // read the variable in place rather than copying it
+      auto key = expr(b->right);
+      auto pc = emit(SUBSCRIPT_VAR, &((Variable *)b->left)->getSymbol(), r);
+      at(pc).c = key;
+      return pc;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+
+  auto left = expr(b->left);
+  auto right = expr(b->right);
+  // operands of known kinds select instructions without conversions: two
+  // numbers, or a string, which makes a comparison a string comparison
+  bool numbers = isKind(b->left, Value::Number) &&
+                 isKind(b->right, Value::Number);
+  bool string = isKind(b->left, Value::String) ||
+                isKind(b->right, Value::String);
+  auto compare = [numbers, string](Opcode general, Opcode number,
+                                   Opcode text) {
+    return (numbers ? number : string ? text : general);
+  };
+  Opcode op = HALT;
+  switch (b->op) {
+  case Binary::EQ:
+    op = compare(EQ, EQ_NUM, EQ_STR);
+    break;
+  case Binary::NE:
+    op = compare(NE, NE_NUM, NE_STR);
+    break;
+  case Binary::LT:
+    op = compare(LT, LT_NUM, LT_STR);
+    break;
+  case Binary::LE:
+    op = compare(LE, LE_NUM, LE_STR);
+    break;
+  case Binary::GE:
+    op = compare(GE, GE_NUM, GE_STR);
+    break;
+  case Binary::GT:
+    op = compare(GT, GT_NUM, GT_STR);
+    break;
+  case Binary::ADD:
+    op = (numbers ? ADD_NUM : ADD);
+    break;
+  case Binary::SUB:
+    op = (numbers ? SUB_NUM : SUB);
+    break;
+  case Binary::MUL:
+    op = (numbers ? MUL_NUM : MUL);
+    break;
+  case Binary::DIV:
+    op = (numbers ? DIV_NUM : DIV);
+    break;
+  case Binary::SUBSCRIPT:
+    op = SUBSCRIPT;
+    break;
+  default:
+    assert(0 && "unexpected binary operator");
+  }
+  return emit(op, r, left, right);
+}
+
+// Compile an if/else if chain comparing one variable with three or more
+// string constants as a SWITCH on a table of the constants, so a line
+// takes one hash lookup to find its branch however long the chain. The
+// variable has no side effects and nothing runs between the tests, so
+// evaluating it once is the same as evaluating it per test.
+bool Compiler::switchChain(IfStatement *chain) {
+  if (!FLAGS_optimize || Context::current()->debug) {
+    return false;
+  }
+  Expression *subject = nullptr;
+  std::vector<std::pair<StringRef, IfStatement *>> cases;
+  Statement *otherwise = nullptr;
+  for (auto i = chain; i;) {
+    Expression *s;
+    StringRef key;
+    if (!switchCase(i->predicate, &s, &key) ||
+        (subject && !sameSubject(subject, s))) {
+      break;
+    }
+    subject = s;
+    cases.emplace_back(key, i);
+    otherwise = i->elseStmts;
+    i = (otherwise && !otherwise->getNext() ? isa<IfStatement>(otherwise)
+                                            : nullptr);
+  }
+  if (cases.size() < 3) {
+    return false;
+  }
+  auto table = program->switches.size();
+  program->switches.emplace_back();
+  emit(SWITCH, expr(subject), table);
+  std::vector<unsigned> done;
+  for (auto &c : cases) {
+    // the first of equal constants is the one taken
+    if (!program->switches[table].cases.emplace(c.first, here()).second) {
+      continue;
+    }
+    statements(c.second->thenStmts);
+    done.push_back(emit(JUMP));
+  }
+  program->switches[table].otherwise = here();
+  statements(otherwise);
+  for (auto pc : done) {
+    at(pc).a = here();
+  }
+  return true;
+}
+
+void Compiler::statements(Statement *list) {
+  for (auto s = list; s; s = s->getNext()) {
+    statement(s);
+  }
+}
+
+// skip to the next input line: continue the innermost loop or, outside
+// of any loop, end the script
+void Compiler::next() {
+  if (innermost) {
+    innermost->nextJumps.push_back(emit(JUMP));
+  } else {
+    emit(HALT);
+  }
+}
+
+void Compiler::statement(Statement *stmt) {
+  auto saved = current;
+  current = stmt;
+  if (Context::current()->debug) {
+    emit(TRACE);
+  }
+  switch (stmt->kind()) {
+  case AST::SkipN:
+    next();
+    break;
+  case AST::CopyN:
+    emit(COPY);
+    next();
+    break;
+  case AST::PrintN: {
+    auto p = (Print *)stmt;
+    emit(PRINT_OPEN, p->buffer ? expr(p->buffer) : NONE);
+    print(p->text);
+    emit(PRINT_END);
+    break;
+  }
+  case AST::ReplaceN: {
+    auto r = (Replace *)stmt;
+    auto pattern = expr(r->pattern);
+    emit(REPLACE_LINE, pattern, expr(r->replacement));
+    break;
+  }
+  case AST::ForeachN:
+    loop((Foreach *)stmt);
+    break;
+  case AST::IfStmtN: {
+    auto i = (IfStatement *)stmt;
+    if (switchChain(i)) {
+      break;
+    }
+    auto test = emit(JUMP_IF_FALSE, expr(i->predicate));
+    statements(i->thenStmts);
+    if (i->elseStmts) {
+      auto done = emit(JUMP);
+      at(test).b = here();
+      statements(i->elseStmts);
+      at(done).a = here();
+    } else {
+      at(test).b = here();
+    }
+    break;
+  }
+  case AST::SetN:
+    set((Set *)stmt);
+    break;
+  case AST::SetAppendN: {
+    // x = append(x, ...) appends in place when x is already a list
+    auto s = (Set *)stmt;
+    auto &symbol = ((Variable *)s->lhs)->getSymbol();
+    auto append = (Call *)s->rhs;
+    assert(append->kind() == AST::CallN);
+    auto general = emit(IF_NOT_LIST, &symbol);
+    for (auto a = append->head->nextArg; a; a = a->nextArg) {
+      emit(LIST_APPEND, &symbol, expr(a->value));
+    }
+    auto done = emit(JUMP);
+    at(general).a = here();
+    set(s);
+    at(done).a = here();
+    break;
+  }
+  case AST::SetConcatN: {
+    // x = $x ... appends in place when x is a plain string; the remaining
+    // terms are evaluated before the variable is modified
+    auto s = (Set *)stmt;
+    auto &symbol = ((Variable *)s->lhs)->getSymbol();
+    auto general = emit(IF_NOT_STRING, &symbol);
+    std::vector<unsigned> leaves;
+    bool prefix = true;
+    s->rhs->walkConcat([this, &leaves, &prefix](Expression *e) {
+      if (prefix) {
+        prefix = false;
+        return;
+      }
+      leaves.push_back(expr(e));
+    });
+    auto start = operands();
+    program->operands.insert(program->operands.end(), leaves.begin(),
+                             leaves.end());
+    auto pc = emit(APPEND_STRING, &symbol);
+    at(pc).b = start;
+    at(pc).c = count(start);
+    auto done = emit(JUMP);
+    at(general).a = here();
+    set(s);
+    at(done).a = here();
+    break;
+  }
+  case AST::ColumnsN: {
+    auto c = (Columns *)stmt;
+    emit(USE_COLUMNS);
+    columns(c->inExpr, c->columns, COLUMNS, NONE);
+    break;
+  }
+  case AST::SplitN: {
+    auto s = (Split *)stmt;
+    auto sep = expr(s->separator);
+    emit(SPLIT_LINE, sep, expr(s->target));
+    break;
+  }
+  case AST::ErrorN:
+    emit(ERROR, expr(((Error *)stmt)->text));
+    break;
+  case AST::StopN: {
+    auto s = (Stop *)stmt;
+    if (s->text) {
+      emit(PRINT_OPEN);
+      print(s->text);
+      emit(PRINT_END);
+    }
+    emit(HALT);
+    break;
+  }
+  case AST::InputN: {
+    auto io = (Input *)stmt;
+    emit(INPUT, expr(io->buffer), io->getShellCmd());
+    break;
+  }
+  case AST::OutputN:
+    emit(OUTPUT, expr(((Output *)stmt)->buffer));
+    break;
+  case AST::CloseN: {
+    auto io = (Close *)stmt;
+    auto name = (io->getMode() == Close::ByName ? expr(io->buffer) : NONE);
+    emit(CLOSE, name, io->getMode());
+    break;
+  }
+  case AST::RequiredN: {
+    auto r = (Required *)stmt;
+    if (r->predicate) {
+      auto ok = emit(JUMP_IF_TRUE, expr(r->predicate));
+      requiredFailure(r->predicate, r->errMsg, false);
+      at(ok).b = here();
+    } else {
+      emit(REQUIRE_COLUMNS, r->getCount());
+    }
+    break;
+  }
+  }
+  current = saved;
+}
+
+void Compiler::requiredFailure(Expression *predicate, Expression *errMsg,
+                               bool atEof) {
+  unsigned flags = (atEof ? 2 : 0);
+  if (auto b = predicate->isOp(Expression::NOT)) {
+    flags |= 1;
+    predicate = b->right;
+  }
+  auto pattern = patternRegister(predicate);
+  emit(FAIL_REQUIRED, pattern, errMsg ? expr(errMsg) : NONE, flags);
+}
+
+void Compiler::set(Set *set) {
+  auto rhs = expr(set->rhs);
+  auto lhs = set->lhs;
+  if (!lhs) {
+    // evaluation of a hoisted expression
+    return;
+  }
+  if (lhs->kind() == AST::VariableN) {
+    emit(SET_VAR, &((Variable *)lhs)->getSymbol(), rhs);
+  } else if (auto b = lhs->isOp(lhs->LOOKUP)) {
+    emit(SET_LOOKUP, rhs, expr(b->right));
+  } else if (auto b = lhs->isOp(lhs->SUBSCRIPT)) {
+    emit(SET_SUBSCRIPT, &((Variable *)b->left)->getSymbol(), rhs,
+         expr(b->right));
+  } else {
+    assert(0 && "not yet implemented non variable lhs");
+  }
+}
+
+// Loop layout:
+//        LOOP_INIT slot, count       when there is a count or last line
+//  head: LOOP_EOF eof                when input is needed
+//        LOOP_COUNT slot, exit, body when there is a count
+//        <predicate>, JUMP_IF_TRUE exit or LOOP_LAST_IF slot
+//  body: ...
+//  next: LOOP_NEXT head or LOOP_NEXT_LAST slot, head, exit
+//  exit:
+void Compiler::loop(Foreach *foreach) {
+  if (kernel(foreach)) {
+    return;
+  }
+  auto c = (Control *)foreach->control;
+  bool all = !c;
+  bool hasCount = c && c->hasLimit();
+  auto predicate = (c ? c->pattern : nullptr);
+  bool stopAfter = c && c->getStopKind() != AST::StopAt;
+  bool hasLast = hasCount || (predicate && stopAfter);
+
+  Loop body{program->loops++, {}};
+  if (hasLast) {
+    emit(LOOP_INIT, body.slot, hasCount ? (unsigned)c->getLimit() : 0);
+  }
+  auto head = here();
+  std::vector<unsigned> exits;
+  unsigned eof = NONE;
+  if (all || predicate) {
+    eof = emit(LOOP_EOF);
+  }
+  unsigned counted = NONE;
+  if (hasCount) {
+    counted = emit(LOOP_COUNT, body.slot);
+    exits.push_back(counted);
+  }
+  if (predicate) {
+    auto p = expr(predicate);
+    if (stopAfter) {
+      emit(LOOP_LAST_IF, body.slot, p);
+    } else {
+      exits.push_back(emit(JUMP_IF_TRUE, p));
+    }
+  }
+  if (counted != NONE) {
+    at(counted).c = here();
+  }
+
+  auto saved = innermost;
+  innermost = &body;
+  statements(foreach->body);
+  innermost = saved;
+
+  for (auto pc : body.nextJumps) {
+    at(pc).a = here();
+  }
+  unsigned last = NONE;
+  if (hasLast) {
+    last = emit(LOOP_NEXT_LAST, body.slot, head);
+  } else {
+    emit(LOOP_NEXT, head);
+  }
+
+  // a required loop reports reaching the end of input
+  unsigned exit = here();
+  if (eof != NONE && c && c->getRequired()) {
+    auto done = emit(JUMP);
+    at(eof).a = here();
+    requiredFailure(c->pattern, c->errorMsg, true);
+    at(done).a = exit = here();
+  } else if (eof != NONE) {
+    at(eof).a = exit;
+  }
+  if (last != NONE) {
+    at(last).c = exit;
+  }
+  for (auto pc : exits) {
+    at(pc).b = exit;
+  }
+}
+
+// the register of a value that does not change within a loop: a
+// constant or a hoisted expression, NONE otherwise
+unsigned Compiler::invariant(Expression *e) {
+  switch (e->kind()) {
+  case AST::HoistedValueRefN:
+  case AST::StringConstN:
+  case AST::NumberN:
+  case AST::LogicalN:
+    return expr(e);
+  default:
+    return NONE;
+  }
+}
+
+// Recognize copy/skip to/past PATTERN and replace X with Y to/past
+// PATTERN, where the patterns and replacement are invariant, and run
+// them as a kernel. Returns false when the loop needs general code.
+bool Compiler::kernel(Foreach *foreach) {
+  if (!FLAGS_optimize || Context::current()->debug) {
+    return false;
+  }
+  Kernel k;
+  auto body = foreach->body;
+  auto next = body->getNext();
+  if (isa<Copy>(body) && !next) {
+    k.body = Kernel::Copy;
+  } else if (isa<Skip>(body) && !next) {
+    k.body = Kernel::Skip;
+  } else if (auto r = isa<Replace>(body)) {
+    if (!next || !isa<Copy>(next) || next->getNext()) {
+      return false;
+    }
+    k.body = Kernel::ReplaceCopy;
+    if (r->pattern->kind() != AST::HoistedValueRefN) {
+      return false;
+    }
+    k.regex = reg(r->pattern);
+    k.replacement = invariant(r->replacement);
+    if (k.replacement == NONE) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+
+  auto c = (Control *)foreach->control;
+  if (!c) {
+    k.all = true;
+  } else {
+    if (c->hasLimit()) {
+      k.count = c->getLimit();
+    }
+    k.stopAfter = (c->getStopKind() != AST::StopAt);
+    k.required = c->getRequired();
+    if (auto p = c->pattern) {
+      // only a match of the current line against an invariant regex
+      auto m = p->isOp(p->MATCH);
+      if (!m || m->right->kind() != AST::HoistedValueRefN ||
+          m->left->kind() != AST::VariableN ||
+          ((Variable *)m->left)->getSymbol().getName() !=
+              AST::CURRENT_LINE_SYM) {
+        return false;
+      }
+      k.pattern = reg(m->right);
+    }
+  }
+
+  program->kernels.push_back(k);
+  auto pc = emit(KERNEL, program->kernels.size() - 1);
+  if (k.required && (k.all || k.pattern != NONE)) {
+    requiredFailure(c->pattern, c->errorMsg, true);
+  }
+  at(pc).b = here();
+  return true;
+}
+
+void Compiler::print(Expression *e) {
+  while (auto b = e->isOp(e->CONCAT)) {
+    print(b->left);
+    e = b->right;
+  }
+  if (auto c = e->isCall(BuiltinCalls::APPEND)) {
+    for (auto a = c->head; a; a = a->nextArg) {
+      print(a->value);
+    }
+    return;
+  }
+  if (auto c = e->isCall(BuiltinCalls::JOIN)) {
+    auto head = c->head;
+    if (!head) {
+      return;
+    }
+    auto sep = expr(head->value);
+    bool first = true;
+    for (auto a = head->nextArg; a; a = a->nextArg) {
+      printListElt(a->value, sep, first);
+      first = false;
+    }
+    return;
+  }
+  emit(PRINT, expr(e));
+}
+
+void Compiler::printListElt(Expression *e, unsigned sep, bool first) {
+  if (auto c = e->isOp(e->CONCAT)) {
+    if (!first) {
+      emit(PRINT_SEP, sep);
+    }
+    print(c);
+    return;
+  }
+  emit(PRINT_ELT, expr(e), sep, first);
+}
+}
+
+const char *opcodeName(Opcode op) { return opcodeNames[op]; }
+
+Program *compile(Statement *script) {
+  auto program = new Program;
+  Compiler(program).compile(script);
+  return program;
+}
+
+void Program::dump() const {
+  auto operand = [](unsigned u) {
+    if (u == NONE) {
+      std::cout << " -";
+    } else {
+      std::cout << ' ' << u;
+    }
+  };
+  for (unsigned pc = 0; pc < code.size(); pc++) {
+    auto &i = code[pc];
+    std::cout << pc << ": " << opcodeName(i.op);
+    operand(i.a);
+    operand(i.b);
+    operand(i.c);
+    operand(i.d);
+    if (usesSymbol(i.op)) {
+      std::cout << " $" << symbols[i.d]->getName();
+    }
+    if (source[pc]) {
+      std::cout << "  ; line " << source[pc]->getSourceLine();
+    }
+    std::cout << '\n';
+  }
+  for (unsigned t = 0; t < switches.size(); t++) {
+    std::cout << "switch " << t << ":";
+    for (auto &c : switches[t].cases) {
+      std::cout << ' ' << c.first << ' ' << c.second;
+    }
+    std::cout << " else " << switches[t].otherwise << '\n';
+  }
+}
+}
@@ -0,0 +1,186 @@
+//
+//  Bytecode.h
+//  rsed
+//
+
+#ifndef Bytecode_h
+#define Bytecode_h
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Value.h"
+
+class Statement;
+class Symbol;
+
+// The optimized script is compiled into a flat sequence of instructions
+// over a file of Value registers. Every expression node owns a register
+// so values computed by hoisted expressions stay live for their uses;
+// constants are loaded into their registers before execution starts.
+//
+// Operand conventions: 'a' is the destination register of an expression
+// or the first operand of a statement, 'b', 'c' and 'd' are further
+// registers, counts or jump targets. Variable length operand lists are
+// stored in Program::operands and referenced by (start, count) in (b, c).
+// Instructions naming a variable hold its index in Program::symbols in 'd'.
+#define RSED_OPCODES(X)                                                        \
+  X(HALT)           /* end of script */                                        \
+  X(JUMP)           /* goto a */                                               \
+  X(JUMP_IF_TRUE)   /* if r[a] goto b */                                       \
+  X(JUMP_IF_FALSE)  /* if !r[a] goto b */                                      \
+  X(SWITCH)         /* goto the case of r[a] in switch table b */              \
+  X(TRACE)          /* debug trace of statement source[pc] */                  \
+  X(LOAD_VAR)       /* r[a] = $d */                                            \
+  X(LOAD_MATCH)     /* r[a] = $b */                                            \
+  X(CALL)           /* r[a] = builtin d (operands b, c) */                     \
+  X(LIST)           /* r[a] = {operands b, c} */                               \
+  X(MAP)            /* r[a] = {key: value operands b, c} */                    \
+  X(PATTERN)        /* r[a] = regex number c compiled from r[b] */             \
+  X(TEST)           /* r[a] = logical(r[b]) */                                 \
+  X(NOT)            /* r[a] = !r[b] */                                         \
+  X(LOOKUP)         /* r[a] = value of symbol named r[b] */                    \
+  X(CONCAT)         /* r[a] = concatenation of operands b, c */                \
+  X(MATCH)          /* r[a] = r[c] matches regex r[b] */                       \
+  X(MATCHES)        /* r[a] = list of matches of regex r[b] in r[c] */         \
+  X(MATCHES_AT)     /* r[a] = match r[d] of regex r[b] in r[c] */              \
+  X(MATCHES_LENGTH) /* r[a] = number of matches of regex r[b] in r[c] */       \
+  X(REPLACE)        /* r[a] = r[c] with regex r[b] replaced by r[d] */         \
+  X(SET_GLOBAL)     /* r[a] = r[b] marked global */                            \
+  X(SPLIT)          /* r[a] = r[b] split at regex r[c] */                      \
+  X(SPLIT_AT)       /* r[a] = word r[d] of r[b] split at regex r[c] */         \
+  X(SPLIT_LENGTH)   /* r[a] = number of words of r[b] split at regex r[c] */   \
+  X(SPLIT_COLUMNS)  /* r[a] = r[d] split at column operands b, c */            \
+  X(EQ)             /* r[a] = r[b] == r[c] */                                  \
+  X(NE)             /* r[a] = r[b] != r[c] */                                  \
+  X(LT)             /* r[a] = r[b] < r[c] */                                   \
+  X(LE)             /* r[a] = r[b] <= r[c] */                                  \
+  X(GE)             /* r[a] = r[b] >= r[c] */                                  \
+  X(GT)             /* r[a] = r[b] > r[c] */                                   \
+  X(ADD)            /* r[a] = r[b] + r[c] */                                   \
+  X(SUB)            /* r[a] = r[b] - r[c] */                                   \
+  X(MUL)            /* r[a] = r[b] * r[c] */                                   \
+  X(DIV)            /* r[a] = r[b] / r[c] */                                   \
+  X(NEG)            /* r[a] = -r[b] */                                         \
+  X(EQ_NUM)         /* r[a] = r[b] == r[c], both numbers */                    \
+  X(NE_NUM)         /* r[a] = r[b] != r[c], both numbers */                    \
+  X(LT_NUM)         /* r[a] = r[b] < r[c], both numbers */                     \
+  X(LE_NUM)         /* r[a] = r[b] <= r[c], both numbers */                    \
+  X(GE_NUM)         /* r[a] = r[b] >= r[c], both numbers */                    \
+  X(GT_NUM)         /* r[a] = r[b] > r[c], both numbers */                     \
+  X(EQ_STR)         /* r[a] = r[b] == r[c], one a string */                    \
+  X(NE_STR)         /* r[a] = r[b] != r[c], one a string */                    \
+  X(LT_STR)         /* r[a] = r[b] < r[c], one a string */                     \
+  X(LE_STR)         /* r[a] = r[b] <= r[c], one a string */                    \
+  X(GE_STR)         /* r[a] = r[b] >= r[c], one a string */                    \
+  X(GT_STR)         /* r[a] = r[b] > r[c], one a string */                     \
+  X(ADD_NUM)        /* r[a] = r[b] + r[c], both numbers */                     \
+  X(SUB_NUM)        /* r[a] = r[b] - r[c], both numbers */                     \
+  X(MUL_NUM)        /* r[a] = r[b] * r[c], both numbers */                     \
+  X(DIV_NUM)        /* r[a] = r[b] / r[c], both numbers */                     \
+  X(NEG_NUM)        /* r[a] = -r[b], a number */                               \
+  X(SUBSCRIPT)      /* r[a] = r[b][r[c]] */                                    \
+  X(SUBSCRIPT_VAR)  /* r[a] = $d[r[c]] */                                      \
+  X(SET_VAR)        /* $d = r[a] */                                            \
+  X(SET_LOOKUP)     /* symbol named r[b] = r[a] */                             \
+  X(SET_SUBSCRIPT)  /* $d[r[b]] = r[a] */                                      \
+  X(IF_NOT_LIST)    /* if $d is not a list goto a */                           \
+  X(LIST_APPEND)    /* append r[a] to list $d */                               \
+  X(IF_NOT_STRING)  /* if $d is not a plain string goto a */                   \
+  X(APPEND_STRING)  /* append operands b, c to string $d */                    \
+  X(PRINT_OPEN)     /* print to file named r[a], or the output if NONE */      \
+  X(PRINT)          /* print r[a] */                                           \
+  X(PRINT_ELT)      /* print r[a] as join() would after separator r[b], */     \
+                    /* c set for the first element */                          \
+  X(PRINT_SEP)      /* print separator r[a] */                                 \
+  X(PRINT_END)      /* end the printed line */                                 \
+  X(COPY)           /* copy the current line to the output */                  \
+  X(REPLACE_LINE)   /* replace regex r[a] in current line by r[b] */           \
+  X(USE_COLUMNS)    /* clear the columns used for $1... */                     \
+  X(COLUMNS)        /* split r[d] at column operands b, c for $1... */         \
+  X(SPLIT_LINE)     /* split r[b] at regex r[a] for $1... */                   \
+  X(ERROR)          /* raise error r[a] */                                     \
+  X(REQUIRE_COLUMNS) /* raise an error unless there are a columns */           \
+  X(FAIL_REQUIRED)  /* raise a required pattern error for pattern r[a], */     \
+                    /* message r[b]; c is 1 if forbidden, 2 at end of input */ \
+  X(INPUT)          /* read from r[a], a shell command if b */                 \
+  X(OUTPUT)         /* write to file named r[a] */                             \
+  X(CLOSE)          /* close file a by mode b */                               \
+  X(LOOP_INIT)      /* start loop slot a with count b */                       \
+  X(LOOP_EOF)       /* at end of input goto a else read the line */            \
+  X(LOOP_COUNT)     /* leave loop slot a at b once the count is done, */       \
+                    /* goto c for its last line */                             \
+  X(LOOP_LAST_IF)   /* make this the last line of loop slot a if r[b] */       \
+  X(LOOP_NEXT)      /* read the next line and goto a */                        \
+  X(LOOP_NEXT_LAST) /* like LOOP_NEXT to b but leave loop slot a at c */       \
+                    /* after its last line */                                  \
+  X(KERNEL)         /* run kernel a then goto b, or continue at a */           \
+                    /* required end of input */
+
+namespace Bytecode {
+
+enum Opcode : unsigned char {
+#define RSED_OPCODE_ENUM(name) name,
+  RSED_OPCODES(RSED_OPCODE_ENUM)
+#undef RSED_OPCODE_ENUM
+};
+
+// no register, file name or message
+enum : unsigned { NONE = ~0u };
+
+struct Instruction {
+  Opcode op;
+  unsigned a, b, c, d;
+  constexpr Instruction(Opcode op, unsigned a = NONE, unsigned b = NONE,
+                        unsigned c = NONE, unsigned d = NONE)
+      : op(op), a(a), b(b), c(c), d(d) {}
+};
+
+// A foreach that only copies, skips or replaces and copies each line,
+// with at most a count and a match of the current line as its control.
+// The VM runs it as a single loop rather than instruction by instruction.
+struct Kernel {
+  enum Body : unsigned char { Copy, Skip, ReplaceCopy };
+  Body body;
+  // the control: all lines, a line count (0 for none) and a regex
+  // register (NONE for none) ending the loop at or after a matching line
+  bool all = false;
+  unsigned count = 0;
+  unsigned pattern = NONE;
+  bool stopAfter = false;
+  bool required = false;
+  // the regex and replacement text registers of ReplaceCopy
+  unsigned regex = NONE;
+  unsigned replacement = NONE;
+};
+
+// the cases of a SWITCH: where each string goes, and where the rest do
+struct SwitchTable {
+  std::unordered_map<StringRef, unsigned, StringRef::Hash> cases;
+  unsigned otherwise = NONE;
+};
+
+struct Program {
+  std::vector<Instruction> code;
+  // the statement each instruction belongs to, for error reporting
+  std::vector<Statement *> source;
+  std::vector<unsigned> operands;
+  std::vector<Symbol *> symbols;
+  // initial register values: constants and default values
+  std::vector<Value> registers;
+  unsigned loops = 0;
+  std::vector<Kernel> kernels;
+  std::vector<SwitchTable> switches;
+
+  void dump() const;
+};
+
+const char *opcodeName(Opcode op);
+Program *compile(Statement *script);
+// write a C++ translation unit that runs the program when linked with
+// the rsed runtime
+void emitCpp(const Program &program, const std::string &scriptName,
+             std::ostream &out);
+}
+
+#endif /* Bytecode_h */
@@ -0,0 +1,23 @@
+//
+//  Context.cpp
+//  rsed
+//
+
+#include "Context.h"
+#include "RegEx.h"
+#include "Symbol.h"
+
+thread_local Context *Context::current_ = nullptr;
+
+Context::Context() : regEx(RegEx::makeDefaultRegEx()) {}
+
+Context::~Context() {
+  // closing files and releasing symbols may refer to the context
+  Scope scope(*this);
+  files = nullptr;
+  for (auto &s : symbols) {
+    delete s.second;
+  }
+  symbols.clear();
+  interned.clear();
+}
@@ -0,0 +1,65 @@
+//
+//  Context.h
+//  rsed
+//
+
+#ifndef Context_h
+#define Context_h
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "StringRef.h"
+
+class RegEx;
+class Symbol;
+
+// The state shared by everything that parses, optimizes and runs one
+// script: its symbols, interned strings, regular expressions, open files
+// and debugging settings. An Interpreter owns one, and it is made current
+// on the thread working on that script, so independent scripts may run
+// in one process, concurrently when each is on its own thread.
+class Context {
+  static thread_local Context *current_;
+
+public:
+  Context();
+  ~Context();
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+
+  // the context of the script this thread is working on
+  static Context *current() { return current_; }
+
+  // makes a context current for the lifetime of the scope
+  class Scope {
+    Context *saved;
+
+  public:
+    explicit Scope(Context &context) : saved(current_) {
+      current_ = &context;
+    }
+    ~Scope() { current_ = saved; }
+  };
+
+  int debug = 0;
+  int dump = 0;
+  // file to save referenced environment variables
+  std::ofstream envSave;
+
+  // symbols keyed by interned names
+  std::unordered_map<StringRef, Symbol *, StringRef::Hash> symbols;
+  unsigned nextTemp = 0;
+  std::unordered_set<StringRef, StringRef::Hash> interned;
+
+  // numbering of AST nodes and of the regular expressions of the script
+  int nextId = 0;
+  int nextPattern = 0;
+  std::unique_ptr<RegEx> regEx;
+
+  // named and temporary files, and pipes (LineBuffer.cpp)
+  struct Files;
+  std::shared_ptr<Files> files;
+};
+
+#endif /* Context_h */
@@ -0,0 +1,375 @@
+//
+//  Driver.cpp
+//  rsed
+//
+//  Created by David Callahan on 6/24/15.
+//  Copyright (c) 2015 David Callahan. All rights reserved.
+//
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <assert.h>
+#include <glob.h>
+#include "gflags/gflags.h"
+#include "Context.h"
+#include "AST.h"
+#include "Parser.h"
+#include "Scanner.h"
+#include "RegEx.h"
+#include "Exception.h"
+#include "Interpreter.h"
+#include "Optimize.h"
+#include "LineBuffer.h"
+#include "Parallel.h"
+#include "Runtime.h"
+
+using std::string;
+
+extern int yydebug;
+static bool scriptIn;
+static string input("");
+
+DEFINE_bool(debug, false, "enable debugging");
+DEFINE_bool(yydebug, false, "enable parser debugging");
+DEFINE_bool(dump, false, "dump parsed script");
+DEFINE_string(input, "", "input file to be processed");
+DEFINE_bool(script_in, false, "read script from stdin");
+DEFINE_string(env_save, "", "file to save referenced environment variables");
+DEFINE_int32(test, 0, "test number");
+DEFINE_string(emit_cpp, "",
+              "write the script as C++ to this file rather than run it");
+DEFINE_int32(threads, 1, "threads to run a script whose input lines are "
+                         "independent of each other, 0 for one per core");
+// large enough to cover handing a chunk to a thread, small enough to keep
+// every thread busy
+DEFINE_int32(chunk_size, 256 * 1024,
+             "input bytes per chunk of a script run on threads");
+DEFINE_string(batch, "",
+              "run the script over each input file matching this pattern, "
+              "or named on the lines of the file after a leading @");
+DEFINE_string(batch_suffix, "",
+              "write the output of each batch file to its name plus this "
+              "suffix rather than to the standard output");
+DEFINE_bool(pipeline, false,
+            "read the input and write the output on threads of their own");
+static string script;
+
+static std::stringstream temp;
+#define MAKE_STRING(x) \
+    (temp.str(""), temp << x, temp.str())
+
+
+// a compiled script has no script parameter
+static void parseOptions(int *argc, char **argv[], bool compiled,
+                         Context &context) {
+
+  gflags::ParseCommandLineFlags(argc, argv, true);
+
+  // only command line arguments are preserved by gflags, so the 0th one is
+  // the tool name and 1st is the input.
+  context.debug = FLAGS_debug;
+  yydebug = FLAGS_yydebug;
+  context.dump = FLAGS_dump;
+  input = FLAGS_input;
+  scriptIn = FLAGS_script_in;
+  const char * err = nullptr;
+  if (FLAGS_test > 0) {
+    script = MAKE_STRING("test" << FLAGS_test << ".rsed");
+    input = MAKE_STRING("test" << FLAGS_test << ".in");
+    std::ifstream temp(input);
+    if (temp.fail()) {
+      input = "";
+    }
+  }
+  else if (compiled) {
+    script = "";
+  } else if (scriptIn) {
+    if (input == "") {
+      err = "missing input file";
+    }
+    script = "";
+  } else if (*argc < 2) {
+    err = "missing script parameter";
+  } else {
+    script = (*argv)[1];
+    *argc -= 1;
+    *argv += 1;
+  }
+  if (FLAGS_batch != "" && scriptIn) {
+    err = "batch requires a script file";
+  }
+  if (FLAGS_env_save != "") {
+    context.envSave.open(FLAGS_env_save);
+    if (!context.envSave.is_open()) {
+        err = "unable to open env_save file";
+    }
+  }
+  if (err) {
+    std::cerr << argv[0] << ":" << err << '\n';
+    exit (1);
+  }
+}
+
+std::ostream &operator<<(std::ostream &OS, const Exception &e) {
+  if (e.input && e.input->getLineno() > 0) {
+    OS << "input " << e.input->getLineno() << ": ";
+  }
+  if (e.statement) {
+    OS << "script " << e.statement->getSourceLine() << ": ";
+  }
+  return OS << e.message << '\n';
+}
+
+
+// with -pipeline, the input and the standard output of a serial run are
+// read and written by threads of their own; returns that output
+static std::shared_ptr<LineBuffer> initialize(Interpreter &interp, int argc,
+                                              char *argv[]) {
+  auto &context = interp.getContext();
+  if (!FLAGS_pipeline || FLAGS_threads != 1 || FLAGS_batch != "" ||
+      FLAGS_emit_cpp != "" || context.debug || context.dump) {
+    interp.initialize(argc, argv, input);
+    return nullptr;
+  }
+  auto output = LineBuffer::makeWriterStdout();
+  interp.initialize(argc, argv, LineBuffer::makeReaderInBuffer(input), output);
+  return output;
+}
+
+static string scriptText() {
+  std::ifstream in(script);
+  std::stringstream text;
+  text << in.rdbuf();
+  return text.str();
+}
+
+static unsigned threadCount() {
+  if (FLAGS_threads <= 0) {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+  return FLAGS_threads;
+}
+
+// run a line independent script on FLAGS_threads threads
+static int runInParallel(int argc, char *argv[]) {
+  auto text = scriptText();
+  std::vector<string> args(argv + 1, argv + argc);
+  auto threads = threadCount();
+  int rc = 1;
+  try {
+    auto in = (input.empty() ? LineBuffer::getStdin()
+                             : LineBuffer::makeInBuffer(input));
+    rc = runParallel(text, args, *in, *LineBuffer::getStdout(),
+                     threads, std::max(1, FLAGS_chunk_size));
+    LineBuffer::closeAll();
+  }
+  catch (Exception &e) {
+    std::cerr << e;
+  }
+  return rc;
+}
+
+// the files named by FLAGS_batch
+static bool batchFiles(std::vector<string> *files) {
+  if (FLAGS_batch[0] == '@') {
+    std::ifstream list(FLAGS_batch.substr(1));
+    if (!list) {
+      std::cerr << "unable to open batch list " << FLAGS_batch.substr(1)
+                << '\n';
+      return false;
+    }
+    string name;
+    while (std::getline(list, name)) {
+      if (!name.empty()) {
+        files->push_back(name);
+      }
+    }
+    return true;
+  }
+  glob_t matches;
+  if (glob(FLAGS_batch.c_str(), 0, nullptr, &matches) != 0) {
+    std::cerr << "no batch files match " << FLAGS_batch << '\n';
+    return false;
+  }
+  files->assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+  globfree(&matches);
+  return true;
+}
+
+// run the script over each batch file on FLAGS_threads threads, or in
+// order on one thread if the files share the files the script writes
+static int runBatchFiles(Statement *ast, int argc, char *argv[]) {
+  std::vector<string> files;
+  if (!batchFiles(&files)) {
+    return 1;
+  }
+  std::vector<string> args(argv + 1, argv + argc);
+  auto threads = (Optimize::writesFiles(ast) ? 1 : threadCount());
+  int rc = 1;
+  try {
+    rc = runBatch(scriptText(), args, files, FLAGS_batch_suffix,
+                  *LineBuffer::getStdout(), threads);
+    LineBuffer::closeAll();
+  }
+  catch (Exception &e) {
+    std::cerr << e;
+  }
+  return rc;
+}
+
+int runScript(int argc, char *argv[]) {
+  Interpreter interp;
+  Context::Scope scope(interp.getContext());
+  parseOptions(&argc, &argv, false, interp.getContext());
+  std::shared_ptr<LineBuffer> output;
+  try {
+    output = initialize(interp, argc, argv);
+  }
+  catch (Exception &e) {
+    std::cerr << e;
+    exit(1);
+  }
+
+  Parser parser;
+  Statement *ast = parser.parse(script);
+  if (!ast) {
+    exit(1);
+  }
+  if (interp.getContext().dump) {
+    ast->dump();
+  }
+  if (FLAGS_batch != "") {
+    return runBatchFiles(ast, argc, argv);
+  }
+  if (FLAGS_threads != 1 && !scriptIn && !interp.getContext().debug &&
+      !interp.getContext().dump && FLAGS_env_save == "" &&
+      FLAGS_emit_cpp == "" && Optimize::lineIndependent(ast)) {
+    return runInParallel(argc, argv);
+  }
+  ast = Optimize::optimize(ast);
+  if (FLAGS_emit_cpp != "") {
+    std::unique_ptr<Bytecode::Program> program(Bytecode::compile(ast));
+    std::ofstream out(FLAGS_emit_cpp);
+    Bytecode::emitCpp(*program, script, out);
+    if (!out) {
+      std::cerr << "unable to write " << FLAGS_emit_cpp << '\n';
+      return 1;
+    }
+    return 0;
+  }
+
+  int rc = 0;
+  try {
+    interp.interpret(ast);
+    LineBuffer::closeAll();
+  }
+  catch (Exception & e) {
+    // the output before the error comes first, as it would from std::cout
+    if (output) {
+      output->close();
+    }
+    std::cerr << e;
+    rc = 1;
+  }
+  return rc;
+}
+
+
+// run a compiled script over each batch file in turn, each from a fresh
+// interpreter; the files the script names are shared by the batch, as
+// with runBatch, and closed with 'batch'
+static int runCompiledBatch(int argc, char *argv[], BuildScript build,
+                            RunScript run) {
+  std::vector<string> files;
+  if (!batchFiles(&files)) {
+    return 1;
+  }
+  int rc = 0;
+  Context batch;
+  for (auto &name : files) {
+    Interpreter interp;
+    interp.getContext().files = batch.files;
+    Context::Scope scope(interp.getContext());
+    std::ifstream in(name);
+    std::ofstream out;
+    if (!in) {
+      std::cerr << name << ": unable to open input\n";
+      rc = 1;
+      continue;
+    }
+    if (FLAGS_batch_suffix != "") {
+      out.open(name + FLAGS_batch_suffix);
+      if (!out) {
+        std::cerr << name << ": unable to open output " << name
+                  << FLAGS_batch_suffix << '\n';
+        rc = 1;
+        continue;
+      }
+    }
+    auto read = [&in](string &line) { return bool(std::getline(in, line)); };
+    auto write = [&out](const char *text, size_t length) {
+      if (out.is_open()) {
+        out.write(text, length);
+      } else {
+        std::cout.write(text, length);
+      }
+    };
+    Bytecode::Program program;
+    try {
+      interp.initialize(argc, argv,
+                        LineBuffer::makeCallbackInBuffer(read, name),
+                        LineBuffer::makeCallbackOutBuffer(write, "<output>"));
+      build(program);
+      interp.run(program, run);
+      LineBuffer::closeAll();
+    }
+    catch (Exception & e) {
+      try {
+        LineBuffer::closeAll();
+      } catch (Exception &) {
+      }
+      std::cerr << name << ": " << e;
+      rc = 1;
+    }
+    batch.files = interp.getContext().files;
+  }
+  return rc;
+}
+
+int runCompiled(int argc, char *argv[], BuildScript build, RunScript run) {
+  Interpreter interp;
+  Context::Scope scope(interp.getContext());
+  parseOptions(&argc, &argv, true, interp.getContext());
+  if (FLAGS_batch != "") {
+    return runCompiledBatch(argc, argv, build, run);
+  }
+  std::shared_ptr<LineBuffer> output;
+  try {
+    output = initialize(interp, argc, argv);
+  }
+  catch (Exception &e) {
+    std::cerr << e;
+    exit(1);
+  }
+
+  Bytecode::Program program;
+  int rc = 0;
+  try {
+    build(program);
+    interp.run(program, run);
+    LineBuffer::closeAll();
+  }
+  catch (Exception & e) {
+    // the output before the error comes first, as it would from std::cout
+    if (output) {
+      output->close();
+    }
+    std::cerr << e;
+    rc = 1;
+  }
+  return rc;
+}
+
+void breakPoint() { std::cout << "at break\n"; }
@@ -0,0 +1,298 @@
+//
+//  EmitCpp.cpp
+//  rsed
+//
+
+#include "Bytecode.h"
+#include <cmath>
+#include <cstdio>
+#include <set>
+#include "AST.h"
+#include "Symbol.h"
+
+// A compiled program is written as a C++ translation unit: the
+// instructions become a constant table, and the dispatch loop becomes
+// straight line code with a label at each branch target and a call to
+// the exec function of each instruction (Runtime.h). With the operands
+// constant the C++ compiler can specialize each call. The remaining
+// tables (constants, symbols, kernels, source lines) are filled in when
+// the program starts.
+
+namespace Bytecode {
+
+namespace {
+
+// a C++ string literal for 'text'
+std::string literal(const StringRef &text) {
+  std::string result("\"");
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (c >= ' ' && c < 0x7f && c != '?') {
+      result += c;
+    } else {
+      // octal escapes, which unlike \x end after three digits
+      char buffer[8];
+      std::snprintf(buffer, sizeof(buffer), "\\%03o", c);
+      result += buffer;
+    }
+  }
+  return result + '"';
+}
+
+std::string number(double value) {
+  if (value != value) {
+    return "std::nan(\"\")";
+  }
+  if (std::isinf(value)) {
+    return (value < 0 ? "-HUGE_VAL" : "HUGE_VAL");
+  }
+  char buffer[40];
+  std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+  return buffer;
+}
+
+std::string operand(unsigned u) {
+  return (u == NONE ? "NONE" : std::to_string(u));
+}
+
+// the targets of a SWITCH, each once
+std::set<unsigned> switchTargets(const SwitchTable &table) {
+  std::set<unsigned> targets{table.otherwise};
+  for (auto &c : table.cases) {
+    targets.insert(c.second);
+  }
+  return targets;
+}
+
+// the instructions that can transfer control, and where to
+void branchTargets(const Program &p, const Instruction &i,
+                   std::set<unsigned> *targets) {
+  switch (i.op) {
+  case SWITCH: {
+    auto cases = switchTargets(p.switches[i.b]);
+    targets->insert(cases.begin(), cases.end());
+    break;
+  }
+  case JUMP:
+  case IF_NOT_LIST:
+  case IF_NOT_STRING:
+  case LOOP_EOF:
+  case LOOP_NEXT:
+    targets->insert(i.a);
+    break;
+  case JUMP_IF_TRUE:
+  case JUMP_IF_FALSE:
+  case KERNEL:
+    targets->insert(i.b);
+    break;
+  case LOOP_COUNT:
+  case LOOP_NEXT_LAST:
+    targets->insert(i.b);
+    targets->insert(i.c);
+    break;
+  default:
+    break;
+  }
+}
+
+const char *kernelBody(Kernel::Body body) {
+  switch (body) {
+  case Kernel::Copy:
+    return "Kernel::Copy";
+  case Kernel::Skip:
+    return "Kernel::Skip";
+  case Kernel::ReplaceCopy:
+    return "Kernel::ReplaceCopy";
+  }
+  return "";
+}
+}
+
+void emitCpp(const Program &program, const std::string &scriptName,
+             std::ostream &out) {
+  auto &code = program.code;
+  out << "// " << scriptName << " compiled by rsed -emit_cpp\n"
+      << "#include <cmath>\n"
+      << "#include <iterator>\n"
+      << "#include <map>\n"
+      << "#include \"Runtime.h\"\n\n"
+      << "using namespace Bytecode;\n\n"
+      << "namespace {\n"
+      << "constexpr Instruction code[] = {\n";
+  for (auto &i : code) {
+    out << "    Instruction(" << opcodeName(i.op) << ", " << operand(i.a)
+        << ", " << operand(i.b) << ", " << operand(i.c) << ", "
+        << operand(i.d) << "),\n";
+  }
+  out << "};\n\n";
+
+  // the tables
+  out << "void build(Program &p) {\n"
+      << "  p.code.assign(std::begin(code), std::end(code));\n";
+  out << "  // statements stand in for the script lines of errors\n"
+      << "  std::map<int, Statement *> lines;\n"
+      << "  auto line = [&lines](int n) -> Statement * {\n"
+      << "    auto &s = lines[n];\n"
+      << "    if (!s) {\n"
+      << "      s = new Skip(n);\n"
+      << "    }\n"
+      << "    return s;\n"
+      << "  };\n";
+  out << "  p.source = {";
+  for (unsigned pc = 0; pc < code.size(); pc++) {
+    auto s = program.source[pc];
+    out << (pc % 8 ? " " : "\n      ");
+    if (s) {
+      out << "line(" << s->getSourceLine() << "),";
+    } else {
+      out << "nullptr,";
+    }
+  }
+  out << "};\n";
+  out << "  p.operands = {";
+  for (unsigned k = 0; k < program.operands.size(); k++) {
+    out << (k % 12 ? " " : "\n      ") << program.operands[k] << ',';
+  }
+  out << "};\n";
+  for (auto symbol : program.symbols) {
+    out << "  p.symbols.push_back(Symbol::findSymbol("
+        << literal(StringRef(symbol->getName())) << "));\n";
+  }
+  out << "  p.registers.resize(" << program.registers.size() << ");\n";
+  for (unsigned r = 0; r < program.registers.size(); r++) {
+    auto &v = program.registers[r];
+    switch (v.kind) {
+    case Value::String: {
+      auto &s = v.getString();
+      out << "  p.registers[" << r << "] = Value(StringRef(" << literal(s)
+          << ", " << s.length() << ", " << unsigned(s.getFlags()) << ")"
+          << (s.isInterned() ? ".intern()" : "") << ");\n";
+      break;
+    }
+    case Value::Number:
+      out << "  p.registers[" << r << "] = Value(double("
+          << number(v.getNumber()) << "));\n";
+      break;
+    case Value::Logical:
+      if (v.getLogical()) {
+        out << "  p.registers[" << r << "] = Value(true);\n";
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  out << "  p.loops = " << program.loops << ";\n";
+  for (auto &k : program.kernels) {
+    out << "  {\n"
+        << "    Kernel k;\n"
+        << "    k.body = " << kernelBody(k.body) << ";\n"
+        << "    k.all = " << (k.all ? "true" : "false") << ";\n"
+        << "    k.count = " << k.count << ";\n"
+        << "    k.pattern = " << operand(k.pattern) << ";\n"
+        << "    k.stopAfter = " << (k.stopAfter ? "true" : "false") << ";\n"
+        << "    k.required = " << (k.required ? "true" : "false") << ";\n"
+        << "    k.regex = " << operand(k.regex) << ";\n"
+        << "    k.replacement = " << operand(k.replacement) << ";\n"
+        << "    p.kernels.push_back(k);\n"
+        << "  }\n";
+  }
+  for (auto &t : program.switches) {
+    out << "  p.switches.emplace_back();\n"
+        << "  p.switches.back().otherwise = " << t.otherwise << ";\n";
+    for (auto &c : t.cases) {
+      out << "  p.switches.back().cases.emplace(StringRef("
+          << literal(c.first) << ", " << c.first.length() << ").intern(), "
+          << c.second << ");\n";
+    }
+  }
+  out << "}\n\n";
+
+  // the code
+  std::set<unsigned> targets;
+  for (auto &i : code) {
+    branchTargets(program, i, &targets);
+  }
+  out << "void run(State &s, const Program &p) {\n"
+      << "  auto r = s.enter(p);\n"
+      << "  unsigned pc = 0;\n"
+      << "  try {\n";
+  for (unsigned pc = 0; pc < code.size(); pc++) {
+    auto &i = code[pc];
+    if (targets.count(pc)) {
+      out << "  L" << pc << ":\n";
+    }
+    out << "    pc = " << pc << ";\n";
+    std::string exec = std::string("exec") + opcodeName(i.op) +
+                       "(s, p, r, code[" + std::to_string(pc) + "])";
+    switch (i.op) {
+    case HALT:
+      out << "    return;\n";
+      break;
+    case JUMP:
+      out << "    goto L" << i.a << ";\n";
+      break;
+    case TRACE:
+      // tracing finds the statement from the instruction's address
+      out << "    execTRACE(s, p, r, p.code[" << pc << "]);\n";
+      break;
+    case IF_NOT_LIST:
+    case IF_NOT_STRING:
+    case LOOP_EOF:
+      out << "    if (" << exec << ") {\n"
+          << "      goto L" << i.a << ";\n"
+          << "    }\n";
+      break;
+    case JUMP_IF_TRUE:
+    case JUMP_IF_FALSE:
+    case KERNEL:
+      out << "    if (" << exec << ") {\n"
+          << "      goto L" << i.b << ";\n"
+          << "    }\n";
+      break;
+    case LOOP_COUNT:
+      out << "    switch (" << exec << ") {\n"
+          << "    case " << i.b << ":\n"
+          << "      goto L" << i.b << ";\n";
+      if (i.c != i.b) {
+        out << "    case " << i.c << ":\n"
+            << "      goto L" << i.c << ";\n";
+      }
+      out << "    }\n";
+      break;
+    case SWITCH:
+      out << "    switch (" << exec << ") {\n";
+      for (auto target : switchTargets(program.switches[i.b])) {
+        out << "    case " << target << ":\n"
+            << "      goto L" << target << ";\n";
+      }
+      out << "    }\n";
+      break;
+    case LOOP_NEXT:
+      out << "    " << exec << ";\n"
+          << "    goto L" << i.a << ";\n";
+      break;
+    case LOOP_NEXT_LAST:
+      out << "    if (" << exec << ") {\n"
+          << "      goto L" << i.c << ";\n"
+          << "    }\n"
+          << "    goto L" << i.b << ";\n";
+      break;
+    default:
+      out << "    " << exec << ";\n";
+      break;
+    }
+  }
+  out << "  } catch (Exception &e) {\n"
+      << "    e.setStatement(p.source[pc], s.getInputBuffer());\n"
+      << "    throw;\n"
+      << "  }\n"
+      << "}\n"
+      << "}\n\n"
+      << "int main(int argc, char *argv[]) {\n"
+      << "  return runCompiled(argc, argv, build, run);\n"
+      << "}\n";
+}
+}
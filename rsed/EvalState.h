@@ -19,6 +19,7 @@ protected:
   RegEx *regEx = nullptr;
 
 public:
+  virtual ~EvalState() {}
   virtual unsigned getLineno() const = 0;
   RegEx *getRegEx() const { return regEx; }
   void setRegEx(RegEx *regEx) { this->regEx = regEx; }
@@ -34,4 +34,7 @@ public:
   }
 };
 
+// "input N: script M: message"
+std::ostream &operator<<(std::ostream &OS, const Exception &e);
+
 #endif /* Exceptions_h */
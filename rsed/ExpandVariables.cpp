@@ -18,15 +18,15 @@ static std::regex variable(R"((\\\$)|(\$[a-zA-Z][a-zA-Z0-9_]*)|(\$\{[^}]+\})|(\$
 void ExpandVariables::expand(const StringRef & text) {
   
   if (text.isRaw()) {
-    single(text.getText(),text.getFlags());
+    single(text.str(), text.getFlags());
     return ;
   }
-  const char *ctext = text.getText().c_str();
-  size_t len = text.getText().length();
+  const char *ctext = text.data();
+  size_t len = text.length();
   auto vars_begin = std::cregex_iterator(ctext, ctext + len, ::variable);
   auto vars_end = std::cregex_iterator();
   if (vars_begin == vars_end) {
-    single(text.getText(), text.getFlags());
+    single(text.str(), text.getFlags());
     return ;
   }
   
@@ -8,203 +8,23 @@
 
 #include "Interpreter.h"
 #include <assert.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <sstream>
 #include <iostream>
 #include <vector>
-#include "rsed.h"
-#include "Symbol.h"
-#include "AST.h"
+#include "Runtime.h"
 #include "ASTWalk.h"
-#include "LineBuffer.h"
-#include "RegEx.h"
-#include "BuiltinCalls.h"
-#include "EvalState.h"
-#include "Exception.h"
-#include "Value.h"
 #include "ExpandVariables.h"
+#include <gflags/gflags.h>
 
 using std::vector;
 using std::string;
 using std::stringstream;
-using namespace RSED;
+using namespace Bytecode;
 
-namespace {
-enum ResultCode {
-  OK_S,   // continue
-  NEXT_S, // skip to next line
-  STOP_S, // terminate script
-};
-enum MatchKind { NoMatchK, StopAtK, StopAfterK };
-}
-
-class State : public EvalState {
-  std::shared_ptr<LineBuffer> inputBuffer;
-
-  vector<std::shared_ptr<LineBuffer>> inputStack;
-  vector<std::shared_ptr<LineBuffer>> outputStack;
-
-public:
-  std::shared_ptr<LineBuffer> stdinBuffer;
-  std::shared_ptr<LineBuffer> stdoutBuffer;
-  // use columns are match for $1, $2,...
-  bool matchColumns = true;
-  vector<string> columns;
-
-  StringPtr currentLine_;
-  bool needLine = true;
-  StringPtr getCurrentLine() {
-    if (needLine) {
-      nextLine();
-    }
-    return currentLine_;
-  }
-
-  std::shared_ptr<LineBuffer> getInputBuffer() const { return inputBuffer; }
-  void pushInput(std::shared_ptr<LineBuffer> newInput) {
-    inputStack.push_back(std::move(inputBuffer));
-    resetInput(newInput);
-  }
-  void popInput() {
-    if (!inputStack.empty()) {
-      resetInput(inputStack.back());
-      inputStack.pop_back();
-    }
-  }
-  void pushOutput(std::shared_ptr<LineBuffer> newOutput) {
-    outputStack.push_back(std::move(outputBuffer));
-    outputBuffer = std::move(newOutput);
-  }
-  void popOutput() {
-    if (!outputStack.empty()) {
-      outputBuffer = outputStack.back();
-      outputStack.pop_back();
-    }
-  }
-  void releaseFiles() {
-    inputBuffer = nullptr;
-    outputBuffer = nullptr;
-    inputStack.clear();
-    outputStack.clear();
-  }
-  string match(unsigned i) {
-    if (matchColumns) {
-      if (i >= columns.size()) {
-        return "";
-      }
-      return columns[i];
-    } else {
-      return regEx->getSubMatch(i);
-    }
-  }
-  bool inputEof_ = false;
-  bool getInputEof() {
-    if (needLine) {
-      nextLine();
-    }
-    return inputEof_;
-  }
-  StringPtr getInputLine() {
-    if (needLine) {
-      nextLine();
-    }
-    return inputBuffer->getInputLine();
-  }
-  void nextLine() {
-    if (!inputEof_) {
-      inputEof_ = !inputBuffer->nextLine();
-      currentLine_ = inputBuffer->getInputLine();
-      if (debug) {
-        std::cout << "input: " << currentLine_->getText() << "\n";
-      }
-      needLine = false;
-    }
-  }
-  unsigned getLineno() const override {
-    return inputBuffer->getLineno() + unsigned(needLine);
-  }
-  void resetInput(const std::shared_ptr<LineBuffer> &newBuffer) {
-    needLine = true;
-    currentLine_ = nullptr;
-    inputEof_ = false;
-    inputBuffer = newBuffer;
-  }
-
-  std::shared_ptr<LineBuffer> outputBuffer;
-
-  ResultCode interpret(Statement *stmtList);
-  ResultCode interpretOne(Statement *stmt);
-  ResultCode interpret(Foreach *foreach);
-  ResultCode interpret(IfStatement *ifstmt);
-  void interpret(Set *set);
-  void interpret(SetAppend *set);
-  void interpret(Columns *cols, vector<string> *columns);
-  void getColumns(Expression *inExpr, Expression *cols,
-                  vector<string> *columns);
-  void interpret(Split *split);
-
-  bool interprettPredicate(Expression *predicate);
-  Value *interpret(Expression *);
-  void print(Expression *, LineBuffer &);
-  void print(Value *, LineBuffer &);
-  void printListElt(Expression *e, const string &sep, LineBuffer &out,
-                    bool first);
-  Value *getPattern(Expression *);
-  string getRequiredMessage(Expression *pattern, Expression *errMsg);
-
-  // string expandVariables(const string &text) override;
-  stringstream &expandVariables(const string &text, stringstream &str) override;
-};
-
-class ForeachControl {
-  State *state;
-  MatchKind matchKind = NoMatchK;
-  bool hasCount = true;
-  unsigned count = 0;
-  bool all = false;
-  Expression *predicate = nullptr;
-
-public:
-  ForeachControl(State *state) : state(state) {}
-  void initialize(Control *c);
-  MatchKind eval();
-  void release() {}
-  bool needsInput() const { return all || predicate; }
-  ~ForeachControl() { release(); }
-};
-
-MatchKind ForeachControl::eval() {
-  if (all) {
-    return NoMatchK;
-  }
-  if (hasCount) {
-    if (count == 0)
-      return StopAtK;
-    count -= 1;
-    if (count == 0)
-      return StopAfterK;
-  }
-  if (predicate) {
-    if (state->interprettPredicate(predicate)) {
-      return matchKind;
-    }
-    return NoMatchK;
-  }
-  return NoMatchK;
-}
-
-void ForeachControl::initialize(Control *c) {
-  predicate = nullptr;
-  if (!c) {
-    all = true;
-    return;
-  }
-  hasCount = c->hasLimit();
-  if (hasCount) {
-    count = (unsigned)c->getLimit();
-  }
-  matchKind = (c->getStopKind() == AST::StopAt ? StopAtK : StopAfterK);
-  predicate = c->pattern;
-}
+DEFINE_bool(dump_bytecode, false, "dump the compiled script");
 
 namespace {
 class DynamicExpander : public ExpandVariables {
@@ -215,301 +35,456 @@ public:
   DynamicExpander(State &state, stringstream &out) : state(state), out(out) {}
   void single(const std::string &text, unsigned) override { out << text; }
   void string(stringstream &s, unsigned) override { out << s.str(); }
-  void varMatch(unsigned i) override { out << state.match(i); };
+  void varMatch(unsigned i) override { write(state.match(i)); };
   void variable(std::string name) override {
-    out << Symbol::findSymbol(name)->getValue()->asString().getText();
+    write(Symbol::findSymbol(name)->getValue()->asString());
   }
+  void write(const StringRef &s) { out.write(s.data(), s.length()); }
 };
 }
 
 stringstream &State::expandVariables(const string &text, stringstream &str) {
   DynamicExpander expander(*this, str);
-  expander.expand(StringRef(string(text), 0)); // todo clean this op
+  expander.expand(StringRef(text)); // todo clean this op
   return str;
 }
 
-/// interpret all statements on a list until an error
-/// is seen or som
-ResultCode State::interpret(Statement *stmtList) {
-  ResultCode rc = OK_S;
-  stmtList->walk([this, &rc](Statement *stmt) {
-    try {
-      rc = interpretOne(stmt);
-    } catch (Exception &e) {
-      e.setStatement(stmt, inputBuffer);
-      throw;
-    }
-    return (rc == OK_S ? AST::SkipChildrenW : AST::StopW);
-  });
-  return rc;
+// Computed goto is used where available so each instruction jumps
+// directly to the handler of the next; otherwise a switch.
+#if defined(__GNUC__) && !defined(RSED_SWITCH_DISPATCH)
+#define RSED_THREADED_DISPATCH 1
+#endif
+
+Value *State::enter(const Program &program) {
+  registers = program.registers;
+  loopCounts.assign(program.loops, 0);
+  loopLast.assign(program.loops, false);
+  return registers.data();
 }
 
-ResultCode State::interpret(Foreach *foreach) {
-  auto c = (Control *)foreach->control;
-  ForeachControl fc(this);
-  fc.initialize(c);
+/// execute a compiled script until it halts or raises an error
+void State::run(const Program &program) {
+  auto r = enter(program);
+  auto code = program.code.data();
+  unsigned pc = 0;
+
+#ifdef RSED_THREADED_DISPATCH
+  static const void *const labels[] = {
+#define RSED_OPCODE_LABEL(name) &&do_##name,
+      RSED_OPCODES(RSED_OPCODE_LABEL)
+#undef RSED_OPCODE_LABEL
+  };
+  // the handler of each instruction
+  vector<const void *> targets(program.code.size());
+  for (unsigned i = 0; i < targets.size(); i++) {
+    targets[i] = labels[code[i].op];
+  }
+#define OP(name) do_##name:
+#define DISPATCH() goto *targets[pc]
+#else
+#define OP(name) case name:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT()                                                                 \
+  do {                                                                         \
+    pc++;                                                                      \
+    DISPATCH();                                                                \
+  } while (0)
+#define GOTO(target)                                                           \
+  do {                                                                         \
+    pc = (target);                                                             \
+    DISPATCH();                                                                \
+  } while (0)
+#define EXEC(name) exec##name(*this, program, r, code[pc])
+// an instruction without branches
+#define STEP(name)                                                             \
+  OP(name) {                                                                   \
+    EXEC(name);                                                                \
+    NEXT();                                                                    \
+  }
+// an instruction that branches to 'field' when its exec returns true
+#define BRANCH(name, field)                                                    \
+  OP(name) {                                                                   \
+    if (EXEC(name)) {                                                          \
+      GOTO(code[pc].field);                                                    \
+    }                                                                          \
+    NEXT();                                                                    \
+  }
+
+  try {
+#ifdef RSED_THREADED_DISPATCH
+    DISPATCH();
+#else
+  dispatch:
+    switch (code[pc].op) {
+#endif
+    OP(HALT) { return; }
+    OP(JUMP) { GOTO(code[pc].a); }
+    BRANCH(JUMP_IF_TRUE, b)
+    BRANCH(JUMP_IF_FALSE, b)
+    OP(SWITCH) { GOTO(EXEC(SWITCH)); }
+    STEP(TRACE)
+    STEP(LOAD_VAR)
+    STEP(LOAD_MATCH)
+    STEP(CALL)
+    STEP(LIST)
+    STEP(MAP)
+    STEP(PATTERN)
+    STEP(TEST)
+    STEP(NOT)
+    STEP(LOOKUP)
+    STEP(CONCAT)
+    STEP(MATCH)
+    STEP(MATCHES)
+    STEP(MATCHES_AT)
+    STEP(MATCHES_LENGTH)
+    STEP(REPLACE)
+    STEP(SET_GLOBAL)
+    STEP(SPLIT)
+    STEP(SPLIT_AT)
+    STEP(SPLIT_LENGTH)
+    STEP(SPLIT_COLUMNS)
+    STEP(EQ)
+    STEP(NE)
+    STEP(LT)
+    STEP(LE)
+    STEP(GE)
+    STEP(GT)
+    STEP(ADD)
+    STEP(SUB)
+    STEP(MUL)
+    STEP(DIV)
+    STEP(NEG)
+    STEP(EQ_NUM)
+    STEP(NE_NUM)
+    STEP(LT_NUM)
+    STEP(LE_NUM)
+    STEP(GE_NUM)
+    STEP(GT_NUM)
+    STEP(EQ_STR)
+    STEP(NE_STR)
+    STEP(LT_STR)
+    STEP(LE_STR)
+    STEP(GE_STR)
+    STEP(GT_STR)
+    STEP(ADD_NUM)
+    STEP(SUB_NUM)
+    STEP(MUL_NUM)
+    STEP(DIV_NUM)
+    STEP(NEG_NUM)
+    STEP(SUBSCRIPT)
+    STEP(SUBSCRIPT_VAR)
+    STEP(SET_VAR)
+    STEP(SET_LOOKUP)
+    STEP(SET_SUBSCRIPT)
+    BRANCH(IF_NOT_LIST, a)
+    STEP(LIST_APPEND)
+    BRANCH(IF_NOT_STRING, a)
+    STEP(APPEND_STRING)
+    STEP(PRINT_OPEN)
+    STEP(PRINT)
+    STEP(PRINT_ELT)
+    STEP(PRINT_SEP)
+    STEP(PRINT_END)
+    STEP(COPY)
+    STEP(REPLACE_LINE)
+    STEP(USE_COLUMNS)
+    STEP(COLUMNS)
+    STEP(SPLIT_LINE)
+    STEP(ERROR)
+    STEP(REQUIRE_COLUMNS)
+    STEP(FAIL_REQUIRED)
+    STEP(INPUT)
+    STEP(OUTPUT)
+    STEP(CLOSE)
+    STEP(LOOP_INIT)
+    BRANCH(LOOP_EOF, a)
+    OP(LOOP_COUNT) {
+      auto target = EXEC(LOOP_COUNT);
+      if (target != NONE) {
+        GOTO(target);
+      }
+      NEXT();
+    }
+    STEP(LOOP_LAST_IF)
+    OP(LOOP_NEXT) {
+      EXEC(LOOP_NEXT);
+      GOTO(code[pc].a);
+    }
+    OP(LOOP_NEXT_LAST) {
+      if (EXEC(LOOP_NEXT_LAST)) {
+        GOTO(code[pc].c);
+      }
+      GOTO(code[pc].b);
+    }
+    BRANCH(KERNEL, b)
+#ifndef RSED_THREADED_DISPATCH
+    }
+#endif
+  } catch (Exception &e) {
+    e.setStatement(program.source[pc], inputBuffer);
+    throw;
+  }
+#undef OP
+#undef DISPATCH
+#undef NEXT
+#undef GOTO
+#undef EXEC
+#undef STEP
+#undef BRANCH
+}
 
-  auto b = foreach->body;
+// The loop of a foreach compiled as a kernel, following the steps of the
+// general LOOP_* instructions. Returns false on reaching the end of input
+// in a required loop.
+bool State::runKernel(const Kernel &k, Value *registers) {
+  bool needsInput = k.all || k.pattern != NONE;
+  int pattern = (k.pattern == NONE ? -1 : registers[k.pattern].getRegEx());
+  int regex = (k.regex == NONE ? -1 : registers[k.regex].getRegEx());
+  StringRef replacement;
+  if (k.replacement != NONE) {
+    replacement = registers[k.replacement].asString();
+  }
+  auto count = k.count;
   for (;;) {
-    if (fc.needsInput()) {
+    if (needsInput) {
       if (getInputEof()) {
-        if (c && c->getRequired()) {
-          string msg = getRequiredMessage(c->pattern, c->errorMsg);
-          throw Exception("at end of input, " + msg, foreach, inputBuffer);
-        }
-        break;
+        return !k.required;
       }
       getCurrentLine();
     }
-    auto mk = fc.eval();
-    if (mk == StopAtK) {
-      break;
+    bool last = false;
+    if (k.count) {
+      if (count == 0) {
+        return true;
+      }
+      last = (--count == 0);
+    }
+    if (!last && pattern >= 0) {
+      matchColumns = false;
+      if (regEx->match(pattern, getCurrentLine())) {
+        if (!k.stopAfter) {
+          return true;
+        }
+        last = true;
+      }
     }
-    auto rc = interpret(b);
-    if (rc == STOP_S) {
-      return rc;
+    switch (k.body) {
+    case Kernel::Copy:
+      outputBuffer->appendLine(getCurrentLine());
+      break;
+    case Kernel::Skip:
+      break;
+    case Kernel::ReplaceCopy:
+      currentLine_ = regEx->replace(regex, replacement, getCurrentLine());
+      outputBuffer->appendLine(currentLine_);
+      break;
     }
-    if (mk == StopAfterK) {
+    if (last) {
       needLine = true;
-      break;
+      return true;
     }
     nextLine();
   }
-  return OK_S;
 }
 
-ResultCode State::interpret(IfStatement *ifstmt) {
-
-  if (interprettPredicate(ifstmt->predicate)) { // true
-    return interpret(ifstmt->thenStmts);
+void State::concat(Value *result, const unsigned *leaves, unsigned count,
+                   Value *registers) {
+  bool isList = true;
+  for (unsigned i = 0; i < count; i++) {
+    if (!registers[leaves[i]].isList()) {
+      isList = false;
+      break;
+    }
   }
-  if (auto e = ifstmt->elseStmts) {
-    return interpret(e);
+  if (isList) {
+    result->clearList();
+    for (unsigned i = 0; i < count; i++) {
+      for (auto &v : registers[leaves[i]].getList()) {
+        result->append(v);
+      }
+    }
+  } else if (count == 1) {
+    result->set(registers[leaves[0]].asString());
+  } else {
+    size_t length = 0;
+    unsigned flags = 0;
+    for (unsigned i = 0; i < count; i++) {
+      auto &s = registers[leaves[i]].asString();
+      length += s.length();
+      flags |= s.getFlags();
+    }
+    StringRef text;
+    auto target = text.allocate(length, flags);
+    for (unsigned i = 0; i < count; i++) {
+      auto &s = registers[leaves[i]].asString();
+      std::memcpy(target, s.data(), s.length());
+      target += s.length();
+    }
+    result->set(std::move(text));
   }
-  return OK_S;
 }
 
-ResultCode State::interpretOne(Statement *stmt) {
-  if (debug) {
-    std::cout << "trace " << inputBuffer->getLineno() << ":";
-    stmt->dumpOne();
-  }
-  switch (stmt->kind()) {
-  case AST::SkipN:
-    return NEXT_S;
-  case AST::CopyN:
-    outputBuffer->appendLine(getCurrentLine()->getText());
-    return NEXT_S;
-  case AST::PrintN: {
-    auto p = (Print *)stmt;
-    auto out = outputBuffer;
-    if (auto b = p->buffer) {
-      auto v = interpret(b);
-      if (!v->isString()) {
-        throw Exception("invalid file name" + v->asString(), stmt, inputBuffer);
-      }
-      out = LineBuffer::findOutputBuffer(v->asString().getText());
+void State::getColumns(StringRef inExpr, const unsigned *cols, unsigned count,
+                       Value *registers, vector<StringRef> *columns) {
+  columns->clear();
+  int lastC = 0;
+  int max = inExpr.length();
+  for (unsigned c = 0; c < count; c++) {
+    auto v = &registers[cols[c]];
+    auto i = int(v->asNumber());
+    if (i < lastC) {
+      throw Exception("column numbers must be positive and non-decreasing: " +
+                      v->asString());
     }
-    print(p->text, *out);
-    out->appendString("\n");
-    break;
-  }
-  case AST::ReplaceN: {
-    auto r = (Replace *)stmt;
-    auto reg = interpret(r->pattern)->getRegEx();
-    auto target = interpret(r->replacement)->asString().getText();
-    auto str = regEx->replace(reg, target, getCurrentLine()->getText());
-    currentLine_ = std::make_shared<const StringRef>(std::move(str), 0);
-    break;
-  }
-  case AST::ForeachN:
-    return interpret((Foreach *)stmt);
-  case AST::IfStmtN:
-    return interpret((IfStatement *)stmt);
-  case AST::SetN:
-    interpret((Set *)stmt);
-    break;
-  case AST::SetAppendN:
-    interpret((SetAppend *)stmt);
-    break;
-  case AST::ColumnsN:
-    matchColumns = true;
-    interpret((Columns *)stmt, &columns);
-    break;
-  case AST::SplitN:
-    interpret((Split *)stmt);
-    break;
-  case AST::ErrorN: {
-    auto e = (Error *)stmt;
-    auto msg = interpret(e->text)->asString().getText();
-    throw Exception(msg, stmt, inputBuffer);
+    i = std::min(i, max);
+    columns->push_back(inExpr.slice(lastC, i - lastC));
+    lastC = i;
   }
-  case AST::StopN: {
-    auto e = (Stop *)stmt;
-    if (e->text) {
-      print(e->text, *outputBuffer);
-      outputBuffer->appendString("\n");
-    }
-    return STOP_S;
+
+  if (lastC < inExpr.length()) {
+    columns->push_back(inExpr.slice(lastC, inExpr.length() - lastC));
+  } else {
+    columns->emplace_back();
   }
-  case AST::InputN: {
-    auto io = (Input *)stmt;
-    auto value = interpret(io->buffer);
-    if (value->kind == Value::List) {
-      vector<string> data;
-      for (auto &v : value->list) {
-        data.emplace_back(v.asString().getText());
-      }
-      pushInput(LineBuffer::makeVectorInBuffer(&data, "from list"));
+}
+
+void State::subscript(Value *result, Value *list, Value *key) {
+  if (list->isMap()) {
+    auto v = list->mapFind(key->asString());
+    if (v) {
+      result->set(v);
     } else {
-      auto fileName = value->asString().getText();
-      if (io->getShellCmd()) {
-        // todo: how does "close" work here?
-        pushInput(LineBuffer::makePipeBuffer(fileName));
-      } else {
-        pushInput(LineBuffer::findInputBuffer(fileName));
-      }
+      result->set(StringRef());
     }
-    break;
-  }
-  case AST::OutputN: {
-    auto io = (Output *)stmt;
-    auto fileName = interpret(io->buffer)->asString().getText();
-    outputBuffer = LineBuffer::findInputBuffer(fileName);
-    break;
+    return;
   }
-  case AST::CloseN: {
-    auto io = (Close *)stmt;
-    switch (io->getMode()) {
-    case Close::Input:
-      inputBuffer->close();
-      popInput();
-      break;
-    case Close::Output:
-      outputBuffer->close();
-      popOutput();
-      break;
-    case Close::ByName:
-      auto fileName = interpret(io->buffer)->asString().getText();
-      auto old = LineBuffer::closeBuffer(fileName);
-      if (old == inputBuffer) {
-        popInput();
-      } else if (old == outputBuffer) {
-        popOutput();
-      }
-      break;
+  auto index = listIndex(key);
+  if (list->kind == list->List) {
+    if (index >= list->listLength()) {
+      result->set(StringRef());
+    } else {
+      result->set(&list->getList()[index]);
     }
-    break;
-  }
-  case AST::RequiredN: {
-    auto r = (Required *)stmt;
-    if (r->predicate) {
-      auto pred = r->predicate;
-      if (interprettPredicate(pred)) {
-        return OK_S;
-      }
-      const char *msg = "failed required pattern";
-      if (auto b = pred->isOp(Expression::NOT)) {
-        msg = "failed forbidden pattern";
-        pred = b->right;
-      }
-      string smsg(msg);
-      if (auto pattern = getPattern(pred)) {
-        smsg += ": \"" + pattern->asString().getText() + '"';
-      }
-      if (r->errMsg) {
-        auto e = interpret(r->errMsg);
-        smsg += ": " + e->asString().getText();
-      }
-      throw Exception(smsg, stmt, inputBuffer);
+  } else {
+    auto &str = list->asString();
+    if (index >= str.length()) {
+      result->set(StringRef());
     } else {
-      if (matchColumns && columns.size() >= r->getCount()) {
-        return OK_S;
-      }
-      throw Exception("failed required column count", stmt, inputBuffer);
+      result->set(StringRef(str.data() + index, 1, 0));
     }
   }
-  }
-  return OK_S;
 }
 
-string State::getRequiredMessage(Expression *e, Expression *errMsg) {
-  const char *msg = "failed required pattern";
-  if (auto b = e->isOp(Expression::NOT)) {
-    msg = "failed forbidden pattern";
-    e = b->right;
-  }
-  string smsg(msg);
-  if (auto pattern = getPattern(e)) {
-    smsg += ": \"" + pattern->asString().getText() + '"';
+unsigned State::listIndex(Value *key) {
+  auto index = (int)key->asNumber();
+  if (index < 0) {
+    throw Exception("negative index in subscript");
   }
-  if (errMsg) {
-    auto e = interpret(errMsg);
-    smsg += ": " + e->asString().getText();
+  return index;
+}
+
+void State::wordAt(Value *result, unsigned index) {
+  if (index < words.size()) {
+    result->set(words[index]);
+  } else {
+    result->set(StringRef());
   }
-  return smsg;
+  words.clear();
 }
 
-Value *State::getPattern(Expression *e) {
-  if (e->kind() == AST::RegExPatternN) {
-    return ((RegExPattern *)e)->pattern;
+string State::requiredMessage(Value *pattern, Value *errMsg, unsigned flags) {
+  string smsg(flags & 1 ? "failed forbidden pattern"
+                        : "failed required pattern");
+  if (pattern) {
+    smsg += ": \"" + pattern->asString() + '"';
   }
-  if (e->kind() == AST::HoistedValueRefN) {
-    return getPattern(((HoistedValueRef *)e)->value);
+  if (errMsg) {
+    smsg += ": " + errMsg->asString();
   }
-  if (auto b = e->isOp(e->MATCH)) {
-    return getPattern(b->right);
+  if (flags & 2) {
+    smsg = "at end of input, " + smsg;
   }
-  return nullptr;
+  return smsg;
 }
 
-void State::print(Expression *e, LineBuffer &out) {
-  while (auto b = e->isOp(e->CONCAT)) {
-    print(b->left, out);
-    e = b->right;
-  }
-  if (auto c = e->isCall(BuiltinCalls::APPEND)) {
-    for (auto a = c->head; a; a = a->nextArg) {
-      print(a->value, out);
+void State::input(Value *value, bool shellCmd) {
+  if (value->kind == Value::List) {
+    vector<StringRef> data;
+    for (auto &v : value->getList()) {
+      data.emplace_back(v.asString());
+    }
+    pushInput(LineBuffer::makeVectorInBuffer(&data, "from list"));
+  } else {
+    auto fileName = value->asString().str();
+    if (shellCmd) {
+      // todo: how does "close" work here?
+      pushInput(LineBuffer::makePipeBuffer(fileName));
+    } else {
+      pushInput(LineBuffer::findInputBuffer(fileName));
     }
-    return;
   }
-  if (auto c = e->isCall(BuiltinCalls::JOIN)) {
-    auto head = c->head;
-    if (!head)
-      return;
-    auto sep = interpret(head->value)->asString().getText();
-    bool first = true;
-    for (auto a = head->nextArg; a; a = a->nextArg) {
-      printListElt(a->value, sep, out, first);
-      first = false;
+}
+
+void State::close(Value *name, Close::Mode mode) {
+  switch (mode) {
+  case Close::Input:
+    inputBuffer->close();
+    popInput();
+    break;
+  case Close::Output:
+    outputBuffer->close();
+    popOutput();
+    break;
+  case Close::ByName:
+    auto fileName = name->asString().str();
+    auto old = LineBuffer::closeBuffer(fileName);
+    if (old == inputBuffer) {
+      popInput();
+    } else if (old == outputBuffer) {
+      popOutput();
     }
-    return;
+    break;
   }
-  print(interpret(e), out);
 }
 
+// format leaves directly into the output buffer rather than
+// converting them to strings first
 void State::print(Value *v, LineBuffer &out) {
-  if (v->kind == v->List) {
-    for (auto &lv : v->list) {
+  switch (v->kind) {
+  case Value::List:
+    for (auto &lv : v->getList()) {
       print(&lv, out);
     }
-  } else {
-    out.appendString(v->asString().getText());
+    break;
+  case Value::Number: {
+    char buffer[Value::NUMBER_BUFFER_SIZE];
+    auto length = Value::formatNumber(v->getNumber(), buffer);
+    out.appendString(buffer, length);
+    break;
+  }
+  case Value::Logical:
+    if (v->getLogical()) {
+      out.appendString("true", 4);
+    } else {
+      out.appendString("false", 5);
+    }
+    break;
+  case Value::String:
+    out.appendString(v->getString());
+    break;
+  case Value::Map:
+    throw Exception("unable to print a map");
+  case Value::RegEx:
+    assert(0 && "can not print regex");
+    break;
   }
 }
 
-void State::printListElt(Expression *e, const string &sep, LineBuffer &out,
+void State::printListElt(Value *v, const StringRef &sep, LineBuffer &out,
                          bool first) {
-  if (auto c = e->isOp(e->CONCAT)) {
-    if (!first)
-      out.appendString(sep);
-    print(c, out);
-    return;
-  }
-  auto v = interpret(e);
   if (v->kind == v->List) {
-    for (auto &lv : v->list) {
+    for (auto &lv : v->getList()) {
       if (!first)
         out.appendString(sep);
       print(&lv, out);
@@ -522,108 +497,31 @@ void State::printListElt(Expression *e, const string &sep, LineBuffer &out,
   print(v, out);
 }
 
-void State::interpret(Set *set) {
-  auto rhs = interpret(set->rhs);
-  auto lhs = set->lhs;
-  if (lhs) {
-    if (lhs->kind() == AST::VariableN) {
-      ((Variable *)lhs)->getSymbol().set(rhs);
-      if (debug) {
-        std::cout << "set to " << *rhs << '\n';
-      }
-    } else if (lhs->isOp(lhs->LOOKUP)) {
-      auto b = BinaryP(lhs);
-      auto name = interpret(b->right);
-      if (!name->isString()) {
-        throw Exception("invalid symbol name " + name->asString(), set,
-                        inputBuffer);
-      }
-      auto symbol = Symbol::findSymbol(name->asString().getText());
-      symbol->set(rhs);
-    } else {
-      assert("not yet implemented non variable lhs");
-    }
-  }
-}
-
-void State::interpret(SetAppend *set) {
-  auto lhs = (Variable *)set->lhs;
-  assert(lhs->kind() == AST::VariableN);
-  auto value = lhs->getSymbol().getValue();
-  if (value->kind != value->List) {
-    interpret((Set *)set);
-    return;
-  }
-
-  auto append = (Call *)set->rhs;
-  assert(append->kind() == AST::CallN);
-  auto head = append->head;
-  assert(head && lhs->same(head->value));
-  for (auto a = head->nextArg; a; a = a->nextArg) {
-    value->listAppend(interpret(a->value));
-  }
+Interpreter::~Interpreter() {
+  Context::Scope scope(context);
+  delete state;
 }
 
-void State::interpret(Columns *cols, vector<string> *columns) {
-  getColumns(cols->inExpr, cols->columns, columns);
-}
-
-void State::getColumns(Expression *inExprE, Expression *cols,
-                       vector<string> *columns) {
-  columns->clear();
-  vector<unsigned> nums;
-
-  string inExpr = interpret(inExprE)->asString().getText();
-
-  int lastC = 0;
-  int max = inExpr.length();
-  auto addCol = [this, &lastC, columns, max, cols, inExpr](Expression *e) {
-    auto v = interpret(e);
-    auto i = int(v->asNumber());
-    if (i < lastC) {
-      throw Exception("column numbers must be positive and non-decreasing: " +
-                      v->asString());
-    }
-    i = std::min(i, max);
-    columns->push_back(inExpr.substr(lastC, (i - lastC)));
-    lastC = i;
-  };
-
-  cols->walkConcat(addCol);
-
-  if (lastC < inExpr.length()) {
-    columns->push_back(inExpr.substr(lastC));
-  } else {
-    columns->push_back("");
-  }
-}
-
-void State::interpret(Split *split) {
-  auto sep = interpret(split->separator)->getRegEx();
-  const string &target = interpret(split->target)->asString().getText();
-  matchColumns = true;
-  columns.clear();
-  regEx->split(sep, target, &columns);
+void Interpreter::initialize(int argc, char *argv[], const string &input) {
+  Context::Scope scope(context);
+  initialize(argc, argv,
+             (input.empty() ? LineBuffer::getStdin()
+                            : LineBuffer::makeInBuffer(input)),
+             LineBuffer::getStdout());
 }
 
-void Interpreter::initialize(int argc, char *argv[], const string &input) {
+void Interpreter::initialize(int argc, char *argv[],
+                             std::shared_ptr<LineBuffer> input,
+                             std::shared_ptr<LineBuffer> output) {
+  Context::Scope scope(context);
   state = new State;
-  if (input.empty()) {
-    state->stdinBuffer = LineBuffer::getStdin();
-  } else {
-    state->stdinBuffer = LineBuffer::makeInBuffer(input);
-  }
-  state->resetInput(state->stdinBuffer);
-  state->stdinBuffer = nullptr;
-  state->stdoutBuffer = LineBuffer::getStdout();
-  state->outputBuffer = state->stdoutBuffer;
-  state->setRegEx(RegEx::regEx);
+  setIO(std::move(input), std::move(output));
+  state->setRegEx(context.regEx.get());
   Symbol::defineSymbol(makeSymbol("LINE", [this]() {
-    auto line = state->getLineno();
-    stringstream buf;
-    buf << line;
-    string result = buf.str();
-    return result;
+    char buffer[Value::NUMBER_BUFFER_SIZE];
+    auto length = std::snprintf(buffer, sizeof(buffer), "%u",
+                                state->getLineno());
+    return StringRef(buffer, length, 0);
   }));
   Symbol::defineSymbol(makeSymbol(
       AST::CURRENT_LINE_SYM, [this]() { return state->getCurrentLine(); }));
@@ -641,231 +539,41 @@ void Interpreter::initialize(int argc, char *argv[], const string &input) {
 }
 
 bool Interpreter::setInput(const string &fileName) {
+  Context::Scope scope(context);
   state->resetInput(LineBuffer::makeInBuffer(fileName));
   return true;
 }
 
-bool State::interprettPredicate(Expression *predicate) {
-  auto v = interpret(predicate);
-  assert(!v->isString());
-  return v->asLogical();
+void Interpreter::setIO(std::shared_ptr<LineBuffer> input,
+                        std::shared_ptr<LineBuffer> output) {
+  Context::Scope scope(context);
+  state->releaseFiles();
+  state->resetInput(input);
+  state->stdoutBuffer = output;
+  state->outputBuffer = std::move(output);
+  state->matchColumns = true;
+  state->columns.clear();
 }
 
 void Interpreter::interpret(Statement *script) {
-  state->interpret(script);
+  Context::Scope scope(context);
+  std::unique_ptr<Program> program(compile(script));
+  if (FLAGS_dump_bytecode) {
+    program->dump();
+  }
+  state->run(*program);
   state->releaseFiles();
 }
 
-Value *State::interpret(Expression *e) {
-  switch (e->kind()) {
-  case AST::LiatEltN:
-    assert("unexpected arg");
-    break;
-  case AST::ControlN:
-    assert("internal error: unexpected control");
-    break;
-  case AST::VariableN: {
-    e->set(((Variable *)e)->getSymbol().getValue());
-    break;
-  }
-  case AST::NumberN: {
-    e->set(((Number *)e)->getValue());
-    break;
-  }
-  case AST::LogicalN: {
-    e->set(((Logical *)e)->getValue());
-    break;
-  }
-  case AST::VarMatchN: {
-    e->set(match(((VarMatch *)e)->getValue()));
-    break;
-  }
-  case AST::StringConstN:
-    e->set(asShared(((StringConst *)e)->getConstant()));
-    break;
-  case AST::CallN: {
-    auto c = (Call *)e;
-    vector<Value *> args;
-    for (auto a = c->head; a; a = a->nextArg) {
-      args.emplace_back(interpret(a->value));
-    }
-    BuiltinCalls::evalCall(c->getCallId(), args, this, e);
-    break;
-  }
-  case AST::ListN: {
-    auto l = ListP(e);
-    l->clearList();
-    for (auto a = l->head; a; a = a->nextArg) {
-      l->append(*interpret(a->value));
-    }
-    break;
-  }
-  case AST::RegExPatternN: {
-    auto r = (RegExPattern *)e;
-    auto pattern = interpret(r->pattern);
-    regEx->setPattern(pattern->asStringPtr(), r->getIndex());
-    r->setRegEx(r->getIndex());
-    break;
-  }
-  case AST::HoistedValueRefN: {
-    auto h = (HoistedValueRef *)e;
-    while (h->value->kind() == AST::HoistedValueRefN) {
-      h = (HoistedValueRef *)h->value;
-    }
-    return h->value;
-  }
-  case AST::BinaryN: {
-    auto b = (Binary *)e;
-    switch (b->op) {
-    case Binary::NOT: {
-      auto v = interpret(b->right);
-      e->set(!v->asLogical());
-      break;
-    }
-    case Binary::LOOKUP: {
-      auto sym = Symbol::findSymbol(interpret(b->right)->asString().getText());
-      e->set(sym->getValue());
-      break;
-    }
-    case Binary::CONCAT: {
-      bool isList = true;
-      vector<Value *> leaves;
-      e->walkConcat([this, &isList, &leaves](Expression *e) {
-        leaves.push_back(interpret(e));
-        if (leaves.back()->kind != Value::List) {
-          isList = false;
-        }
-      });
-      if (isList) {
-        e->clearList();
-        for (auto leaf : leaves) {
-          for (auto &v : leaf->list) {
-            e->append(v);
-          }
-        }
-      } else {
-        stringstream str;
-        unsigned flags = 0;
-        for (auto leaf : leaves) {
-          auto &s = leaf->asString();
-          str << s.getText();
-          flags |= s.getFlags();
-        }
-        e->set(StringRef(str.str(), flags));
-      }
-      break;
-    }
-    case Binary::MATCH: {
-      auto r = interpret(b->right)->getRegEx();
-      auto target = interpret(b->left)->asString().getText();
-      matchColumns = false;
-      e->set(regEx->match(r, target));
-      break;
-    }
-    case Binary::MATCHES: {
-      auto r = interpret(b->right)->getRegEx();
-      auto target = interpret(b->left)->asString().getText();
-      vector<string> words;
-      regEx->match(r, target, &words);
-      b->set(&words);
-      break;
-    }
-    case Binary::REPLACE: {
-      auto m = (Binary *)b->left;
-      assert(m->isOp(m->MATCH));
-      auto r = interpret(m->right)->getRegEx();
-      auto input = interpret(m->left)->asString().getText();
-      auto replacement = interpret(b->right)->asString().getText();
-      b->set(regEx->replace(r, replacement, input));
-      break;
-    }
-    case Binary::SET_GLOBAL: {
-      auto sc = interpret(b->right)->asString();
-      sc.setIsGlobal();
-      b->set(sc);
-      break;
-    }
-    case Binary::SPLIT_REG: {
-      auto text = interpret(b->left)->asString().getText();
-      auto sep = interpret(b->right)->getRegEx();
-      vector<string> words;
-      regEx->split(sep, text, &words);
-      b->set(&words);
-      break;
-    }
-    case Binary::SPLIT_COLS: {
-      vector<string> words;
-      getColumns(b->left, b->right, &words);
-      b->set(&words);
-      break;
-    }
-    case Binary::EQ:
-      b->set(compare(interpret(b->left), interpret(b->right)) == 0);
-      break;
-    case Binary::NE:
-      b->set(compare(interpret(b->left), interpret(b->right)) != 0);
-      break;
-    case Binary::LT:
-      b->set(compare(interpret(b->left), interpret(b->right)) < 0);
-      break;
-    case Binary::LE:
-      b->set(compare(interpret(b->left), interpret(b->right)) <= 0);
-      break;
-    case Binary::GE:
-      b->set(compare(interpret(b->left), interpret(b->right)) >= 0);
-      break;
-    case Binary::GT:
-      b->set(compare(interpret(b->left), interpret(b->right)) > 0);
-      break;
-    case Binary::ADD:
-      b->set(interpret(b->left)->asNumber() + interpret(b->right)->asNumber());
-      break;
-    case Binary::SUB:
-      b->set(interpret(b->left)->asNumber() - interpret(b->right)->asNumber());
-      break;
-    case Binary::MUL:
-      b->set(interpret(b->left)->asNumber() * interpret(b->right)->asNumber());
-      break;
-    case Binary::DIV:
-      b->set(interpret(b->left)->asNumber() / interpret(b->right)->asNumber());
-      break;
-    case Binary::NEG:
-      b->set(-interpret(b->right)->asNumber());
-      break;
-    case Binary::AND:
-      b->set(interpret(b->left)->asLogical() &&
-             interpret(b->right)->asLogical());
-      break;
-    case Binary::OR:
-      b->set(interpret(b->left)->asLogical() ||
-             interpret(b->right)->asLogical());
-      break;
-    case Binary::SUBSCRIPT: {
-      auto list = interpret(b->left);
-      auto index = (int)interpret(b->right)->asNumber();
-      if (index < 0) {
-        throw Exception("negative index in subscript");
-      }
-      if (list->kind == list->List) {
-        if (index >= list->list.size()) {
-          b->set(StringRef("", 0));
-        } else {
-          b->set(&list->list[index]);
-        }
-      } else {
-        auto &str = list->asString().getText();
-        if (index >= str.length()) {
-          b->set(StringRef("", 0));
-        } else {
-          string temp;
-          temp.append(1, str[index]);
-          b->set(StringRef(std::move(temp), 0));
-        }
-      }
-      break;
-    }
-    }
-  } break;
-  }
-  return e;
+void Interpreter::run(const Program &program) {
+  Context::Scope scope(context);
+  state->run(program);
+  state->releaseFiles();
+}
+
+void Interpreter::run(const Program &program,
+                      void (*script)(State &, const Program &)) {
+  Context::Scope scope(context);
+  script(*state, program);
+  state->releaseFiles();
 }
@@ -8,17 +8,36 @@
 
 #ifndef __rsed__Interpreter__
 #define __rsed__Interpreter__
+#include <memory>
 #include <string>
+#include "Context.h"
 
+class LineBuffer;
 class State;
+namespace Bytecode {
+struct Program;
+}
 
 class Interpreter {
+  Context context;
   State *state = nullptr; 
 public:
   Interpreter() {}
+  ~Interpreter();
+  // current while parsing, optimizing or running a script
+  Context &getContext() { return context; }
   void initialize(int argc, char *argv[], const std::string & input);
+  void initialize(int argc, char *argv[], std::shared_ptr<LineBuffer> input,
+                  std::shared_ptr<LineBuffer> output);
   bool setInput(const std::string &fileName);
+  // start over with a new input and output
+  void setIO(std::shared_ptr<LineBuffer> input,
+             std::shared_ptr<LineBuffer> output);
   void interpret(class Statement *);
+  void run(const Bytecode::Program &program);
+  // run a program with a script compiled by -emit_cpp
+  void run(const Bytecode::Program &program,
+           void (*script)(State &, const Bytecode::Program &));
 };
 
 #endif /* defined(__rsed__Interpreter__) */
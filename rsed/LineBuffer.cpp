@@ -7,17 +7,22 @@
 //
 
 #include "LineBuffer.h"
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "file_buffer/file_buffer.hpp"
 #include <gflags/gflags.h>
-#include "rsed.h"
+#include "Context.h"
 #include "Exception.h"
+#include "Ring.h"
 
 using std::string;
 using std::ifstream;
@@ -27,35 +32,44 @@ using std::vector;
 
 DEFINE_string(save_prefix, "", "prefix ouf copied input data");
 DEFINE_string(replay_prefix, "", "prefix for saved input files");
+DEFINE_int32(temp_spill_size, 1 << 20,
+             "size at which in-memory temporary files are moved to disk");
 
 namespace {
 
 template <typename Stream> class StreamInBuffer : public LineBuffer {
   Stream *stream;
+  bool owns;
+  string line;
 
 public:
-  StreamInBuffer(Stream *stream, std::string name)
-      : LineBuffer(name), stream(stream) {
+  // 'owns' deletes the stream with the buffer
+  StreamInBuffer(Stream *stream, std::string name, bool owns = false)
+      : LineBuffer(name), stream(stream), owns(owns) {
     enableCopy();
   }
+  ~StreamInBuffer() {
+    if (owns) {
+      delete stream;
+    }
+  }
   bool eof() override { return stream->eof(); }
   bool getLine() override {
     if (eof()) {
       return false;
     }
-    string line;
     std::getline(*stream,line);
-    inputLine = std::make_shared<const StringRef>(std::move(line),0);
-    if (eof() && inputLine->getText().empty()){
+    inputLine = StringRef(line);
+    if (eof() && inputLine.empty()){
       return false;
     }
     lineno += 1;
     return true;
   }
-  void appendLine(const std::string &line) override {
+  void appendLine(const char *text, size_t length) override {
     assert(!"invalid append to input buffer");
   }
-  void appendString(const std::string &line) override {
+  void appendString(const char *text, size_t length) override {
     assert(!"invalid append to input buffer");
   }
   void close() override;
@@ -71,17 +85,29 @@ template <> inline void StreamInBuffer<std::ifstream>::close() {
 
 template <typename Stream> class StreamOutBuffer : public LineBuffer {
   Stream *stream;
+  bool owns;
 
 public:
-  StreamOutBuffer(Stream *stream, std::string name)
-      : LineBuffer(name), stream(stream) {}
+  // 'owns' deletes, and so flushes, the stream with the buffer
+  StreamOutBuffer(Stream *stream, std::string name, bool owns = false)
+      : LineBuffer(name), stream(stream), owns(owns) {}
+  ~StreamOutBuffer() {
+    if (owns) {
+      delete stream;
+    }
+  }
   bool eof() override { return false; }
   bool getLine() override {
     assert(!"invalid append to output buffer");
     return false;
   }
-  void appendLine(const std::string &line) override { *stream << line << '\n'; }
-  void appendString(const std::string &line) override { *stream << line; }
+  void appendLine(const char *text, size_t length) override {
+    stream->write(text, length);
+    stream->put('\n');
+  }
+  void appendString(const char *text, size_t length) override {
+    stream->write(text, length);
+  }
   void close() override;
 };
 template class StreamOutBuffer<std::ostream>;
@@ -125,24 +151,24 @@ public:
 };
 
 class VectorInBuffer : public LineBuffer {
-  vector<string> lines;
+  vector<StringRef> lines;
 
 public:
-  VectorInBuffer(vector<string> lines, string name)
+  VectorInBuffer(vector<StringRef> lines, string name)
       : LineBuffer(name), lines(std::move(lines)) {}
   virtual bool eof() override { return lineno >= lines.size(); }
   virtual bool getLine() override {
     if (lineno < lines.size()) {
-      inputLine = std::make_shared<const StringRef>(std::move(lines[lineno++]),0);
+      inputLine = std::move(lines[lineno++]);
       return true;
     } else {
       return false;
     }
   }
-  virtual void appendLine(const std::string &line) override {
+  virtual void appendLine(const char *text, size_t length) override {
     throw Exception("invalid write to vector input file");
   }
-  virtual void appendString(const std::string &line) override {
+  virtual void appendString(const char *text, size_t length) override {
     throw Exception("invalid write to vector input file");
   }
   virtual void close() override {
@@ -151,31 +177,464 @@ public:
   }
 };
 
+// lines supplied by a function, which returns false at end of input
+class CallbackInBuffer : public LineBuffer {
+  LineBuffer::ReadLine read;
+  string line;
+  bool done = false;
+
+public:
+  CallbackInBuffer(LineBuffer::ReadLine read, string name)
+      : LineBuffer(name), read(std::move(read)) {
+    enableCopy();
+  }
+  bool eof() override { return done; }
+  bool getLine() override {
+    if (done || !read(line)) {
+      done = true;
+      return false;
+    }
+    inputLine = StringRef(line);
+    lineno += 1;
+    return true;
+  }
+  void appendLine(const char *text, size_t length) override {
+    throw Exception("invalid write to input " + getName());
+  }
+  void appendString(const char *text, size_t length) override {
+    throw Exception("invalid write to input " + getName());
+  }
+  void close() override {
+    done = true;
+    closed = true;
+  }
+};
+
+// text handed to a function as it is written, lines ending in '\n'
+class CallbackOutBuffer : public LineBuffer {
+  LineBuffer::WriteText write;
+
+public:
+  CallbackOutBuffer(LineBuffer::WriteText write, string name)
+      : LineBuffer(name), write(std::move(write)) {}
+  bool eof() override { return false; }
+  bool getLine() override {
+    assert(!"invalid read of output buffer");
+    return false;
+  }
+  void appendLine(const char *text, size_t length) override {
+    write(text, length);
+    write("\n", 1);
+  }
+  void appendString(const char *text, size_t length) override {
+    write(text, length);
+  }
+  void close() override { closed = true; }
+};
+
+// Input read ahead by a thread of its own and handed over in blocks of
+// whole lines, so the interpreter does not wait on reads.
+const size_t BLOCK_SIZE = 64 * 1024;
+typedef Ring<string, 16> Blocks;
+
+struct Reader {
+  int fd;
+  Blocks blocks;
+  // set by the reader after its last block
+  std::atomic<bool> done{false};
+  // set by the interpreter to stop the reader early
+  std::atomic<bool> stop{false};
+
+  explicit Reader(int fd) : fd(fd) {}
+  ~Reader() {
+    if (fd != STDIN_FILENO) {
+      ::close(fd);
+    }
+  }
+  bool hand(string &block) {
+    Backoff backoff;
+    while (!blocks.push(block)) {
+      if (stop.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      backoff.wait();
+    }
+    return true;
+  }
+  // a block ends at the last '\n' read, and what follows starts the next
+  static void run(std::shared_ptr<Reader> reader) {
+    string block;
+    for (;;) {
+      auto used = block.size();
+      block.resize(used + BLOCK_SIZE);
+      auto n = ::read(reader->fd, &block[used], BLOCK_SIZE);
+      if (n < 0 && errno == EINTR) {
+        block.resize(used);
+        continue;
+      }
+      if (n <= 0) {
+        block.resize(used);
+        if (!block.empty()) {
+          reader->hand(block);
+        }
+        break;
+      }
+      block.resize(used + n);
+      auto end = block.rfind('\n');
+      if (end == string::npos) {
+        continue;
+      }
+      string next(block, end + 1);
+      block.resize(end + 1);
+      if (!reader->hand(block)) {
+        break;
+      }
+      block = std::move(next);
+    }
+    reader->done.store(true, std::memory_order_release);
+  }
+};
+
+class ReaderInBuffer : public LineBuffer {
+  std::shared_ptr<Reader> reader;
+  std::thread thread;
+  string block;
+  size_t position = 0;
+  bool done = false;
+
+  bool nextBlock() {
+    Backoff backoff;
+    for (;;) {
+      if (reader->blocks.pop(block)) {
+        position = 0;
+        return true;
+      }
+      // a block may have been handed over just before 'done'
+      if (reader->done.load(std::memory_order_acquire)) {
+        if (reader->blocks.pop(block)) {
+          position = 0;
+          return true;
+        }
+        return false;
+      }
+      backoff.wait();
+    }
+  }
+
+public:
+  ReaderInBuffer(int fd, std::string name)
+      : LineBuffer(name), reader(std::make_shared<Reader>(fd)) {
+    enableCopy();
+    thread = std::thread(&Reader::run, reader);
+  }
+  ~ReaderInBuffer() {
+    reader->stop = true;
+    // a reader waiting on input that is no longer wanted is left to exit
+    // with the process; it shares only 'reader'
+    if (reader->done) {
+      thread.join();
+    } else {
+      thread.detach();
+    }
+  }
+  bool eof() override { return done; }
+  bool getLine() override {
+    if (done) {
+      return false;
+    }
+    if (position >= block.size() && !nextBlock()) {
+      done = true;
+      return false;
+    }
+    auto end = block.find('\n', position);
+    if (end == string::npos) {
+      end = block.size();
+    }
+    inputLine = StringRef(block.data() + position, end - position, 0);
+    position = end + 1;
+    lineno += 1;
+    return true;
+  }
+  void appendLine(const char *text, size_t length) override {
+    throw Exception("invalid write to input " + getName());
+  }
+  void appendString(const char *text, size_t length) override {
+    throw Exception("invalid write to input " + getName());
+  }
+  void close() override {
+    done = true;
+    closed = true;
+    reader->stop = true;
+  }
+};
+
+// The standard output, collected into blocks which a thread of its own
+// writes, so the interpreter does not wait on writes.
+class WriterOutBuffer : public LineBuffer {
+  Blocks blocks;
+  std::atomic<bool> done{false};
+  // blocks handed to the writer, and written by it
+  size_t handed = 0;
+  std::atomic<size_t> written{0};
+  std::thread thread;
+  string pending;
+
+  // straight to the file descriptor: the main thread may flush std::cout
+  // (through std::cerr) while this one writes
+  void write() {
+    Backoff backoff;
+    string block;
+    for (;;) {
+      if (blocks.pop(block)) {
+        for (size_t n = 0; n < block.size();) {
+          auto w = ::write(STDOUT_FILENO, block.data() + n, block.size() - n);
+          if (w < 0 && errno != EINTR) {
+            break;
+          }
+          n += std::max(w, ssize_t(0));
+        }
+        written.fetch_add(1, std::memory_order_release);
+        continue;
+      }
+      if (done.load(std::memory_order_acquire) &&
+          written.load(std::memory_order_relaxed) == handed) {
+        break;
+      }
+      backoff.wait();
+    }
+  }
+  void hand() {
+    Backoff backoff;
+    while (!blocks.push(pending)) {
+      backoff.wait();
+    }
+    handed += 1;
+    pending.clear();
+  }
+
+public:
+  WriterOutBuffer() : LineBuffer("<stdout>") {
+    std::cout.flush();
+    thread = std::thread(&WriterOutBuffer::write, this);
+  }
+  ~WriterOutBuffer() {
+    if (!pending.empty()) {
+      hand();
+    }
+    done = true;
+    thread.join();
+  }
+  bool eof() override { return false; }
+  bool getLine() override {
+    assert(!"invalid read of output buffer");
+    return false;
+  }
+  void appendLine(const char *text, size_t length) override {
+    pending.append(text, length);
+    pending += '\n';
+    if (pending.size() >= BLOCK_SIZE) {
+      hand();
+    }
+  }
+  void appendString(const char *text, size_t length) override {
+    pending.append(text, length);
+    if (pending.size() >= BLOCK_SIZE) {
+      hand();
+    }
+  }
+  // waits for what was written so far; like the standard output, it is
+  // still written after it is closed
+  void close() override {
+    if (!pending.empty()) {
+      hand();
+    }
+    Backoff backoff;
+    while (written.load(std::memory_order_acquire) < handed) {
+      backoff.wait();
+    }
+    closed = true;
+  }
+};
+
+// contents of a temporary file (see mktemp()) which are kept in memory
+// until they grow past FLAGS_temp_spill_size and are then moved to an
+// unlinked file. If the name is handed to a shell command, the contents
+// are moved to a file of that name, which the command may change, and
+// the file is read back by name. A reader shares the memory or file it
+// started on, which stays valid when the contents move.
+class TempStore {
+  bool named = false;
+
+  void moveTo(FILE *newFile) {
+    if (!newFile) {
+      throw Exception("unable to create temporary file");
+    }
+    if (file) {
+      // a reader may be part way through the old file
+      auto old = file.get();
+      auto at = std::ftell(old);
+      char buffer[8 * 1024];
+      std::rewind(old);
+      while (auto n = std::fread(buffer, 1, sizeof(buffer), old)) {
+        std::fwrite(buffer, 1, n, newFile);
+      }
+      std::fseek(old, at, SEEK_SET);
+    } else {
+      std::fwrite(data->data(), 1, data->length(), newFile);
+      data = std::make_shared<string>();
+    }
+    file.reset(newFile, std::fclose);
+  }
+
+public:
+  std::shared_ptr<string> data = std::make_shared<string>();
+  std::shared_ptr<FILE> file;
+
+  void append(const char *text, size_t length) {
+    if (!file && data->length() + length > size_t(FLAGS_temp_spill_size)) {
+      moveTo(std::tmpfile());
+    }
+    if (file) {
+      std::fwrite(text, 1, length, file.get());
+    } else {
+      data->append(text, length);
+    }
+  }
+  void materialize(const string &name) {
+    if (!named) {
+      moveTo(std::fopen(name.c_str(), "w+"));
+      named = true;
+    }
+    flush();
+  }
+  void flush() {
+    if (file) {
+      std::fflush(file.get());
+    }
+  }
+};
+
+class TempOutBuffer : public LineBuffer {
+  std::shared_ptr<TempStore> store;
+
+public:
+  TempOutBuffer(std::shared_ptr<TempStore> store, std::string name)
+      : LineBuffer(name), store(std::move(store)) {}
+  bool eof() override { return false; }
+  bool getLine() override {
+    assert(!"invalid read from output buffer");
+    return false;
+  }
+  void appendLine(const char *text, size_t length) override {
+    store->append(text, length);
+    store->append("\n", 1);
+  }
+  void appendString(const char *text, size_t length) override {
+    store->append(text, length);
+  }
+  void close() override {
+    store->flush();
+    closed = true;
+  }
+};
+
+// reads a temporary file back from memory or from where it spilled
+class TempInBuffer : public LineBuffer {
+  std::shared_ptr<string> data;
+  size_t position = 0;
+  std::shared_ptr<FILE> file;
+  std::unique_ptr<FILE_buffer> fileBuffer;
+  std::unique_ptr<std::istream> in;
+
+public:
+  TempInBuffer(const TempStore &store, std::string name)
+      : LineBuffer(name), data(store.data), file(store.file) {
+    if (file) {
+      std::rewind(file.get());
+      fileBuffer.reset(new FILE_buffer(file.get(), 8 * 1024));
+      in.reset(new std::istream(fileBuffer.get()));
+    }
+  }
+  bool eof() override {
+    return (in ? in->eof() : position >= data->length());
+  }
+  bool getLine() override {
+    if (in) {
+      if (in->eof()) {
+        return false;
+      }
+      string line;
+      std::getline(*in, line);
+      if (in->eof() && line.empty()) {
+        return false;
+      }
+      inputLine = StringRef(line);
+    } else {
+      auto &data = *this->data;
+      if (position >= data.length()) {
+        return false;
+      }
+      auto end = data.find('\n', position);
+      if (end == string::npos) {
+        end = data.length();
+      }
+      inputLine = StringRef(data.data() + position, end - position, 0);
+      position = end + 1;
+    }
+    lineno += 1;
+    return true;
+  }
+  void appendLine(const char *text, size_t length) override {
+    throw Exception("invalid write to temporary input file");
+  }
+  void appendString(const char *text, size_t length) override {
+    throw Exception("invalid write to temporary input file");
+  }
+  void close() override { closed = true; }
+};
+
 struct Buffer {
   std::shared_ptr<LineBuffer> input = nullptr;
   std::shared_ptr<LineBuffer> output = nullptr;
+  std::shared_ptr<TempStore> temp = nullptr;
+};
+}
+
+struct Context::Files {
+  std::unordered_map<std::string, Buffer> buffers;
+  unsigned inputCount = 0;
+  std::vector<string> tempFileNames;
+  std::vector<std::shared_ptr<LineBuffer>> pipeFiles;
 };
-std::unordered_map<std::string, Buffer> buffers;
-unsigned inputCount = 0;
+
+namespace {
+Context::Files &files() {
+  auto &f = Context::current()->files;
+  if (!f) {
+    f = std::make_shared<Context::Files>();
+  }
+  return *f;
+}
+
 string inputFilename(const string &prefix) {
   std::stringstream ss;
-  ss << prefix << inputCount << ".in";
-  ++inputCount;
+  ss << prefix << files().inputCount++ << ".in";
   return ss.str();
 }
 
 std::shared_ptr<LineBuffer> openInBuffer(std::string fileName) {
   auto f = new std::ifstream(fileName);
-  if (!f || !*f) {
+  if (!*f) {
+    delete f;
     throw Exception("unable to open input file: " + fileName);
   }
-  return std::make_shared<StreamInBuffer<std::ifstream>>(f, fileName);
+  return std::make_shared<StreamInBuffer<std::ifstream>>(f, fileName, true);
 }
 
 std::shared_ptr<LineBuffer> replayFile() {
-  auto c = inputCount;
+  auto c = files().inputCount;
   auto p = openInBuffer(inputFilename(FLAGS_replay_prefix));
-  if (RSED::debug) {
+  if (Context::current()->debug) {
     std::cout << "replaying: " << c << ' ' << p->getName() << '\n';
   }
   return p;
@@ -199,7 +658,7 @@ std::shared_ptr<LineBuffer> LineBuffer::makeInBuffer(std::string fileName) {
 }
 std::shared_ptr<LineBuffer> LineBuffer::getStdin() {
   if (!FLAGS_replay_prefix.empty()) {
-    assert(inputCount == 0);
+    assert(files().inputCount == 0);
     return replayFile();
   }
   return ::makeInBuffer(&std::cin, "<stdin>");
@@ -208,13 +667,35 @@ std::shared_ptr<LineBuffer> LineBuffer::getStdout() {
   return makeOutBuffer(&std::cout, "<stdout>");
 }
 
-std::vector<string> LineBuffer::tempFileNames;
-static std::vector<std::shared_ptr<LineBuffer>> pipeFiles;
+std::shared_ptr<LineBuffer> LineBuffer::makeReaderInBuffer(std::string fileName) {
+  if (!FLAGS_replay_prefix.empty()) {
+    return replayFile();
+  }
+  if (fileName.empty()) {
+    return std::make_shared<ReaderInBuffer>(STDIN_FILENO, "<stdin>");
+  }
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw Exception("unable to open input file: " + fileName);
+  }
+  return std::make_shared<ReaderInBuffer>(fd, fileName);
+}
+std::shared_ptr<LineBuffer> LineBuffer::makeWriterStdout() {
+  return std::make_shared<WriterOutBuffer>();
+}
+
+void LineBuffer::addTempFile(const std::string &name) {
+  files().tempFileNames.push_back(name);
+}
+bool LineBuffer::isTempFile(const std::string &name) {
+  auto &names = files().tempFileNames;
+  return std::find(names.begin(), names.end(), name) != names.end();
+}
 
 bool LineBuffer::nextLine() {
   auto rc = getLine();
   if (rc && copyStream.is_open()) {
-    copyStream << inputLine->getText() << '\n';
+    copyStream.write(inputLine.data(), inputLine.length()) << '\n';
     assert(!copyStream.fail());
   }
   return rc;
@@ -222,8 +703,9 @@ bool LineBuffer::nextLine() {
 
 void LineBuffer::enableCopy() {
   if (!FLAGS_save_prefix.empty()) {
-    if (RSED::env_save.is_open()) {
-      RSED::env_save << "#input " << inputCount << " " << name << "\n";
+    auto &envSave = Context::current()->envSave;
+    if (envSave.is_open()) {
+      envSave << "#input " << files().inputCount << " " << name << "\n";
     }
     string saveName = inputFilename(FLAGS_save_prefix);
     copyStream.open(saveName);
@@ -234,18 +716,20 @@ void LineBuffer::enableCopy() {
 }
 
 void LineBuffer::closeAll() {
-  for (auto &name : LineBuffer::tempFileNames) {
-    auto p = buffers.find(name);
-    if (p != buffers.end()) {
+  auto &f = files();
+  for (auto &name : f.tempFileNames) {
+    auto p = f.buffers.find(name);
+    if (p != f.buffers.end()) {
       Buffer &b = p->second;
       if (b.input && !b.input->closed)
         b.input->close();
       if (b.output && !b.output->closed)
         b.output->close();
+      b.temp = nullptr;
       std::remove(name.c_str());
     }
   }
-  for (auto &p : pipeFiles) {
+  for (auto &p : f.pipeFiles) {
     if (!p->closed) {
       p->close();
     }
@@ -254,7 +738,7 @@ void LineBuffer::closeAll() {
 
 std::shared_ptr<LineBuffer>
 LineBuffer::findOutputBuffer(const std::string &name) {
-  auto p = buffers.insert(std::make_pair(name, Buffer()));
+  auto p = files().buffers.insert(std::make_pair(name, Buffer()));
   Buffer &b = p.first->second;
   if (b.input) {
     if (!b.input->closed) {
@@ -263,20 +747,26 @@ LineBuffer::findOutputBuffer(const std::string &name) {
     b.input = nullptr;
   }
   if (!b.output || b.output->closed) {
+    if (isTempFile(name)) {
+      b.temp = std::make_shared<TempStore>();
+      b.output = std::make_shared<TempOutBuffer>(b.temp, name);
+      return b.output;
+    }
     auto f = new ofstream(name);
     if (!*f) {
+      delete f;
       string error("unable to open file: ");
       error += name;
       throw error;
     }
-    b.output.reset(new StreamOutBuffer<ofstream>(f, name));
+    b.output.reset(new StreamOutBuffer<ofstream>(f, name, true));
   }
   return b.output;
 }
 
 std::shared_ptr<LineBuffer>
 LineBuffer::findInputBuffer(const std::string &name) {
-  auto p = buffers.insert(std::make_pair(name, Buffer()));
+  auto p = files().buffers.insert(std::make_pair(name, Buffer()));
   Buffer &b = p.first->second;
   if (b.output) {
     if (!b.output->closed) {
@@ -285,12 +775,17 @@ LineBuffer::findInputBuffer(const std::string &name) {
     b.output = nullptr;
   }
   if (!b.input || b.input->closed) {
-    b.input = makeInBuffer(name);
+    if (b.temp) {
+      b.input = std::make_shared<TempInBuffer>(*b.temp, name);
+    } else {
+      b.input = makeInBuffer(name);
+    }
   }
   return b.input;
 }
 
 std::shared_ptr<LineBuffer> LineBuffer::closeBuffer(const std::string &name) {
+  auto &buffers = files().buffers;
   auto p = buffers.find(name);
   if (p == buffers.end()) {
     return nullptr;
@@ -317,6 +812,18 @@ std::shared_ptr<LineBuffer> LineBuffer::makePipeBuffer(std::string command) {
     return replayFile();
   }
 
+  // the command may refer to temporary files by name; those it names
+  // are from now on read from the file, which the command may replace
+  auto &f = files();
+  for (auto &name : f.tempFileNames) {
+    auto p = f.buffers.find(name);
+    if (p != f.buffers.end() && p->second.temp &&
+        command.find(name) != string::npos) {
+      p->second.temp->materialize(name);
+      p->second.temp = nullptr;
+    }
+  }
+
   FILE *pipe = nullptr;
   try {
     pipe = popen(command.c_str(), "r");
@@ -327,18 +834,30 @@ std::shared_ptr<LineBuffer> LineBuffer::makePipeBuffer(std::string command) {
     throw Exception("error executing command: " + command);
   }
   auto p = std::make_shared<PipeInBuffer>(pipe, command);
-  pipeFiles.push_back(p);
+  f.pipeFiles.push_back(p);
   return p;
 }
 
 std::shared_ptr<LineBuffer>
-LineBuffer::makeVectorInBuffer(std::vector<std::string> *data,
+LineBuffer::makeVectorInBuffer(std::vector<StringRef> *data,
                                std::string name) {
   return std::make_shared<VectorInBuffer>(std::move(*data), name);
 }
 
+std::shared_ptr<LineBuffer> LineBuffer::makeCallbackInBuffer(ReadLine read,
+                                                          std::string name) {
+  return std::make_shared<CallbackInBuffer>(std::move(read), name);
+}
+std::shared_ptr<LineBuffer>
+LineBuffer::makeCallbackOutBuffer(WriteText write, std::string name) {
+  return std::make_shared<CallbackOutBuffer>(std::move(write), name);
+}
+
+LineBuffer::LineBuffer(std::string name)
+    : name(name), debug(Context::current() && Context::current()->debug) {}
+
 LineBuffer::~LineBuffer() {
-  if(RSED::debug) {
+  if (debug) {
     std::cout << "closing copy of " << name << '\n';
   }  
   if (copyStream.is_open()) {
@@ -10,6 +10,7 @@
 #define __rsed__LineBuffer__
 #include <assert.h>
 #include <fstream>
+#include <functional>
 #include <string>
 #include <vector>
 #include <memory>
@@ -19,40 +20,68 @@
 class LineBuffer {
   std::ofstream copyStream;
   std::string name;
+  // the debug flag of the Context that made the buffer, which may be
+  // freed after that Context has gone
+  bool debug;
   virtual bool getLine() = 0;
 
 protected:
   bool closed = false;
-  StringPtr inputLine;
+  StringRef inputLine;
   int lineno = 0;
   void enableCopy();
 
 public:
-  LineBuffer(std::string name) : name(name) {}
+  LineBuffer(std::string name);
   int getLineno() const { return lineno; }
+  // number the following lines from 'count' + 1
+  void setLinesBefore(int count) { lineno = count; }
   const std::string &getName() const { return name; }
 
   bool nextLine();
   virtual bool eof() = 0;
-  virtual void appendLine(const std::string &line) = 0;
-  virtual void appendString(const std::string &word) = 0;
+  virtual void appendLine(const char *text, size_t length) = 0;
+  virtual void appendString(const char *text, size_t length) = 0;
+  void appendLine(const StringRef &line) {
+    appendLine(line.data(), line.length());
+  }
+  void appendString(const std::string &word) {
+    appendString(word.data(), word.length());
+  }
+  void appendString(const StringRef &word) {
+    appendString(word.data(), word.length());
+  }
   virtual void close() = 0;
   virtual ~LineBuffer();
 
-  StringPtr getInputLine() { return inputLine; }
+  const StringRef &getInputLine() const { return inputLine; }
 
   static std::shared_ptr<LineBuffer> findOutputBuffer(const std::string &);
   static std::shared_ptr<LineBuffer> findInputBuffer(const std::string &);
   static void removeTempFiles(const std::vector<std::string> &names);
   static std::shared_ptr<LineBuffer> closeBuffer(const std::string &);
-  static std::vector<std::string> tempFileNames;
+  static void addTempFile(const std::string &name);
+  static bool isTempFile(const std::string &name);
 
   static std::shared_ptr<LineBuffer> makeInBuffer(std::string);
   static std::shared_ptr<LineBuffer> makePipeBuffer(std::string command);
   static std::shared_ptr<LineBuffer>
-  makeVectorInBuffer(std::vector<std::string> *data, std::string name);
+  makeVectorInBuffer(std::vector<StringRef> *data, std::string name);
+  // buffers over functions rather than files: ReadLine stores the next
+  // line and returns true, or returns false at end of input
+  typedef std::function<bool(std::string &)> ReadLine;
+  typedef std::function<void(const char *, size_t)> WriteText;
+  static std::shared_ptr<LineBuffer> makeCallbackInBuffer(ReadLine read,
+                                                          std::string name);
+  static std::shared_ptr<LineBuffer> makeCallbackOutBuffer(WriteText write,
+                                                           std::string name);
   static std::shared_ptr<LineBuffer> getStdin();
   static std::shared_ptr<LineBuffer> getStdout();
+  // the input file, or the standard input if 'fileName' is empty, read and
+  // the standard output written by threads of their own, handing blocks
+  // of lines to and from the interpreter
+  static std::shared_ptr<LineBuffer> makeReaderInBuffer(std::string fileName);
+  static std::shared_ptr<LineBuffer> makeWriterStdout();
   static void closeAll();
 };
 
@@ -6,14 +6,17 @@
 //
 //
 
+#include <map>
 #include <unordered_set>
 #include <assert.h>
+#include <cstring>
 #include <gflags/gflags.h>
-#include "rsed.h"
+#include "Context.h"
 #include "Optimize.h"
 #include "AST.h"
 #include "ASTWalk.h"
 #include "BuiltinCalls.h"
+#include "Exception.h"
 using std::unordered_set;
 using std::vector;
 
@@ -40,12 +43,20 @@ HoistInfo operator+(HoistInfo h1, unsigned k) {
 class Optimizer {
   bool unknownSymbolSet;
   unordered_set<Symbol *> setInLoop;
+  // the names a $(...) assignment in the loop may write: the constant
+  // text it starts and ends with, or the whole name when it is constant
+  struct NameSet {
+    std::string prefix;
+    std::string suffix;
+    bool exact;
+  };
+  vector<NameSet> setByName;
   void noteSetVariables(Statement *body);
-  bool isInvariant(Symbol *sym) {
-    return !unknownSymbolSet && !sym->isDynamic() && !setInLoop.count(sym);
-  }
+  void noteSetByName(Expression *name);
+  bool isInvariant(Symbol *sym);
   Statement *firstInvariant, *lastInvariant;
   void hoistInvariants(Statement *body);
+  Statement *dropRehoisted(Statement *list);
   HoistInfo checkHoist(Expression **expr);
   HoistInfo checkHoistConcat(Expression **expr);
   void hoist(Expression **expr);
@@ -55,6 +66,721 @@ public:
   Optimizer() {}
   Statement *optimize(Statement *input);
 };
+
+// Constant folding: operators and invariant builtins applied to
+// constants are evaluated here, with the run time's own conversions,
+// and replaced by their value. Folding runs before hoisting so that
+// constant tests can prune the branches they decide. Anything that
+// would raise an error is left for the run time to report.
+
+// the value of a constant expression
+bool isConstant(Expression *e, Value *value) {
+  switch (e->kind()) {
+  case AST::StringConstN:
+    value->set(((StringConst *)e)->getConstant());
+    return true;
+  case AST::NumberN:
+    value->set(((Number *)e)->getValue());
+    return true;
+  case AST::LogicalN:
+    value->set(((Logical *)e)->getValue());
+    return true;
+  default:
+    return false;
+  }
+}
+
+// an expression for a folded value, or 'e' if there is none
+Expression *constant(Value &value, Expression *e) {
+  switch (value.kind) {
+  case Value::String:
+    return new StringConst(value.getString());
+  case Value::Number:
+    return new Number(value.getNumber());
+  case Value::Logical:
+    return new Logical(value.getLogical());
+  default:
+    return e;
+  }
+}
+
+Expression *fold(Expression *e);
+
+// join adjacent constants of a concatenation; a constant is never a
+// list so the result is still a string join
+Expression *foldConcat(Binary *b) {
+  Expression *left = b->left;
+  Binary *inner = nullptr;
+  if (auto c = left->isOp(Binary::CONCAT)) {
+    // (x "a") "b" => x "ab"
+    inner = c;
+    left = c->right;
+  }
+  Value l, r;
+  if (!isConstant(left, &l) || !isConstant(b->right, &r)) {
+    return b;
+  }
+  auto &ls = l.asString();
+  auto &rs = r.asString();
+  StringRef text;
+  auto target = text.allocate(ls.length() + rs.length(),
+                              ls.getFlags() | rs.getFlags());
+  std::memcpy(target, ls.data(), ls.length());
+  std::memcpy(target + ls.length(), rs.data(), rs.length());
+  auto joined = new StringConst(text);
+  if (inner) {
+    inner->right = joined;
+    return inner;
+  }
+  return joined;
+}
+
+// 'true and x' and 'false or x' are 'x' when x is already logical
+Expression *foldLogical(Binary *b) {
+  Value l, r;
+  if (!isConstant(b->left, &l)) {
+    return b;
+  }
+  bool decides = (b->op == Binary::AND ? !l.asLogical() : l.asLogical());
+  if (decides) {
+    return new Logical(l.asLogical());
+  }
+  if (isConstant(b->right, &r)) {
+    return new Logical(r.asLogical());
+  }
+  if (b->right->valueKind() == Value::Logical) {
+    return b->right;
+  }
+  return b;
+}
+
+// fold each term of a concatenation that lists separate values, the
+// columns of a split
+Expression *foldTerms(Expression *e) {
+  if (auto c = e->isOp(Binary::CONCAT)) {
+    c->left = foldTerms(c->left);
+    c->right = foldTerms(c->right);
+    return c;
+  }
+  return fold(e);
+}
+
+Expression *foldBinary(Binary *b) {
+  if (b->left) {
+    b->left = fold(b->left);
+  }
+  if (b->op == Binary::SPLIT_COLS) {
+    b->right = foldTerms(b->right);
+    return b;
+  }
+  b->right = fold(b->right);
+  switch (b->op) {
+  case Binary::CONCAT:
+    return foldConcat(b);
+  case Binary::AND:
+  case Binary::OR:
+    return foldLogical(b);
+  default:
+    break;
+  }
+  Value l, r, result;
+  if (b->left && !isConstant(b->left, &l)) {
+    return b;
+  }
+  if (!isConstant(b->right, &r)) {
+    return b;
+  }
+  switch (b->op) {
+  case Binary::NOT:
+    result.set(!r.asLogical());
+    break;
+  case Binary::NEG:
+    result.set(-r.asNumber());
+    break;
+  case Binary::SET_GLOBAL: {
+    auto s = r.asString();
+    s.setIsGlobal();
+    result.set(s);
+    break;
+  }
+  case Binary::ADD:
+    result.set(l.asNumber() + r.asNumber());
+    break;
+  case Binary::SUB:
+    result.set(l.asNumber() - r.asNumber());
+    break;
+  case Binary::MUL:
+    result.set(l.asNumber() * r.asNumber());
+    break;
+  case Binary::DIV:
+    result.set(l.asNumber() / r.asNumber());
+    break;
+  case Binary::EQ:
+    result.set(equal(&l, &r));
+    break;
+  case Binary::NE:
+    result.set(!equal(&l, &r));
+    break;
+  case Binary::LT:
+    result.set(compare(&l, &r) < 0);
+    break;
+  case Binary::LE:
+    result.set(compare(&l, &r) <= 0);
+    break;
+  case Binary::GE:
+    result.set(compare(&l, &r) >= 0);
+    break;
+  case Binary::GT:
+    result.set(compare(&l, &r) > 0);
+    break;
+  default:
+    // matching, splitting and lookups depend on the input
+    return b;
+  }
+  return constant(result, b);
+}
+
+// a builtin without side effects whose arguments are constant
+Expression *foldCall(Call *call) {
+  auto id = call->getCallId();
+  // escape() depends on the regular expression style of the run
+  if (!BuiltinCalls::invariant(id) || id == BuiltinCalls::ESCAPE) {
+    return call;
+  }
+  std::vector<Value> values;
+  for (auto a = call->head; a; a = a->nextArg) {
+    values.emplace_back();
+    if (!isConstant(a->value, &values.back())) {
+      return call;
+    }
+  }
+  std::vector<Value *> args;
+  for (auto &v : values) {
+    args.push_back(&v);
+  }
+  Value result;
+  BuiltinCalls::evalCall(id, args, nullptr, &result);
+  return constant(result, call);
+}
+
+Expression *fold(Expression *e) {
+  try {
+    switch (e->kind()) {
+    case AST::BinaryN:
+      return foldBinary((Binary *)e);
+    case AST::CallN:
+      for (auto a = CallP(e)->head; a; a = a->nextArg) {
+        a->value = fold(a->value);
+      }
+      return foldCall((Call *)e);
+    case AST::ListN:
+    case AST::MapN:
+      for (auto a = ListP(e)->head; a; a = a->nextArg) {
+        a->value = fold(a->value);
+      }
+      break;
+    case AST::RegExPatternN: {
+      auto p = (RegExPattern *)e;
+      p->pattern = fold(p->pattern);
+      break;
+    }
+    case AST::ControlN: {
+      auto c = (Control *)e;
+      if (c->pattern) {
+        c->pattern = fold(c->pattern);
+      }
+      if (c->errorMsg) {
+        c->errorMsg = fold(c->errorMsg);
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  } catch (Exception &) {
+    // leave it for the run time to report
+  }
+  return e;
+}
+
+void foldConstants(Statement *input) {
+  std::unordered_set<Expression **> columns;
+  input->walk([&columns](Statement *stmt) {
+    if (auto c = isa<Columns>(stmt)) {
+      columns.insert(&c->columns);
+    }
+    return AST::ContinueW;
+  });
+  input->applyExprs(/*recurseIntoForeach*/ true,
+                    [&columns](Expression *&expr) {
+                      if (expr) {
+                        expr = (columns.count(&expr) ? foldTerms(expr)
+                                                     : fold(expr));
+                      }
+                    });
+}
+
+// Identical constant patterns share one regular expression, and so its
+// last search (RegEx.cpp): a statement testing the line against a
+// pattern an earlier statement already tried reuses that result.
+typedef std::map<std::pair<std::string, unsigned>, int> PatternIndexes;
+
+void sharePatterns(Expression *e, PatternIndexes *indexes) {
+  switch (e->kind()) {
+  case AST::RegExPatternN: {
+    auto p = (RegExPattern *)e;
+    if (p->pattern->kind() == AST::StringConstN) {
+      auto &text = ((StringConst *)p->pattern)->getConstant();
+      auto key = std::make_pair(text.str(), text.getFlags());
+      p->setIndex(indexes->emplace(key, p->getIndex()).first->second);
+    } else {
+      sharePatterns(p->pattern, indexes);
+    }
+    break;
+  }
+  case AST::BinaryN:
+    if (auto left = BinaryP(e)->left) {
+      sharePatterns(left, indexes);
+    }
+    sharePatterns(BinaryP(e)->right, indexes);
+    break;
+  case AST::CallN:
+  case AST::ListN:
+  case AST::MapN:
+    for (auto a = ListP(e)->head; a; a = a->nextArg) {
+      sharePatterns(a->value, indexes);
+    }
+    break;
+  case AST::ControlN: {
+    auto c = (Control *)e;
+    if (c->pattern) {
+      sharePatterns(c->pattern, indexes);
+    }
+    if (c->errorMsg) {
+      sharePatterns(c->errorMsg, indexes);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void sharePatterns(Statement *input) {
+  PatternIndexes indexes;
+  input->applyExprs(/*recurseIntoForeach*/ true,
+                    [&indexes](Expression *&expr) {
+                      if (expr) {
+                        sharePatterns(expr, &indexes);
+                      }
+                    });
+}
+
+// Kind inference: follows assignments through the script to find the
+// kind a variable has at each use, which Expression::staticKind extends
+// through operators and builtins so the compiler can pick instructions
+// for numbers or strings. Variables start as strings; a kind is unknown
+// where paths with different kinds meet or after an assignment by name.
+class KindInference {
+  enum : int { NONE = -1, ANY = -2 };
+  static int join(int k1, int k2) {
+    return (k1 == NONE ? k2 : k2 == NONE || k1 == k2 ? k1 : ANY);
+  }
+
+  // the kinds of the variables at one point of the script
+  struct Kinds {
+    bool reached = true;
+    // the kind of variables not in 'kinds'
+    int others = Value::String;
+    std::unordered_map<Symbol *, int> kinds;
+
+    int of(Symbol *sym) const {
+      if (!reached) {
+        return NONE;
+      }
+      if (sym->isDynamic()) {
+        return ANY;
+      }
+      auto k = kinds.find(sym);
+      return (k == kinds.end() ? others : k->second);
+    }
+    // merge another path into this one, returns true if this changed
+    bool join(const Kinds &k);
+  };
+
+  // the states at the next iteration of the enclosing loops
+  vector<Kinds *> loops;
+  // the kinds at each use, when recording
+  bool record = false;
+  std::unordered_map<Variable *, int> uses;
+
+  void expression(Expression *e, const Kinds &state);
+  int kindOf(Expression *e, const Kinds &state);
+  void statements(Statement *list, Kinds &state);
+  void statement(Statement *stmt, Kinds &state);
+  void operands(Statement *stmt, const Kinds &state);
+
+public:
+  void infer(Statement *script);
+};
+
+bool KindInference::Kinds::join(const Kinds &k) {
+  if (!k.reached) {
+    return false;
+  }
+  if (!reached) {
+    *this = k;
+    return true;
+  }
+  bool changed = false;
+  auto merge = [&changed](int &into, int from) {
+    auto j = KindInference::join(into, from);
+    changed |= (j != into);
+    into = j;
+  };
+  for (auto &v : k.kinds) {
+    auto mine = kinds.emplace(v.first, others).first;
+    merge(mine->second, v.second);
+  }
+  for (auto &v : kinds) {
+    if (!k.kinds.count(v.first)) {
+      merge(v.second, k.others);
+    }
+  }
+  merge(others, k.others);
+  return changed;
+}
+
+// note the kinds of the variables used by 'e'
+void KindInference::expression(Expression *e, const Kinds &state) {
+  e->walkDown([this, &state](Expression *e) {
+    if (e->kind() == AST::VariableN) {
+      auto v = (Variable *)e;
+      auto k = state.of(&v->getSymbol());
+      v->setKind(k >= 0, Value::Kind(k >= 0 ? k : 0));
+      if (record) {
+        auto u = uses.emplace(v, NONE).first;
+        u->second = join(u->second, k);
+      }
+    }
+    return AST::ContinueW;
+  });
+}
+
+int KindInference::kindOf(Expression *e, const Kinds &state) {
+  expression(e, state);
+  Value::Kind k;
+  return (e->staticKind(&k) ? int(k) : int(ANY));
+}
+
+void KindInference::statements(Statement *list, Kinds &state) {
+  for (auto s = list; s; s = s->getNext()) {
+    statement(s, state);
+  }
+}
+
+void KindInference::statement(Statement *stmt, Kinds &state) {
+  switch (stmt->kind()) {
+  case AST::ForeachN: {
+    auto f = (Foreach *)stmt;
+    // the state at the top of the loop: on entry or after any iteration
+    Kinds head = state;
+    auto saved = record;
+    record = false;
+    for (;;) {
+      Kinds next;
+      next.reached = false;
+      Kinds body = head;
+      if (f->control) {
+        expression(f->control, body);
+      }
+      loops.push_back(&next);
+      statements(f->body, body);
+      loops.pop_back();
+      next.join(body);
+      if (!head.join(next)) {
+        break;
+      }
+    }
+    record = saved;
+    if (record) {
+      Kinds body = head;
+      Kinds next;
+      if (f->control) {
+        expression(f->control, body);
+      }
+      loops.push_back(&next);
+      statements(f->body, body);
+      loops.pop_back();
+    }
+    state = head;
+    break;
+  }
+  case AST::IfStmtN: {
+    auto ifs = (IfStatement *)stmt;
+    expression(ifs->predicate, state);
+    Kinds otherwise = state;
+    statements(ifs->thenStmts, state);
+    statements(ifs->elseStmts, otherwise);
+    state.join(otherwise);
+    break;
+  }
+  case AST::SkipN:
+  case AST::CopyN:
+    // on to the next iteration, or the end of the script
+    if (!loops.empty()) {
+      loops.back()->join(state);
+    }
+    state.reached = false;
+    break;
+  case AST::StopN:
+  case AST::ErrorN:
+    operands(stmt, state);
+    state.reached = false;
+    break;
+  case AST::SetN:
+  case AST::SetAppendN:
+  case AST::SetConcatN: {
+    auto set = (Set *)stmt;
+    auto k = kindOf(set->rhs, state);
+    auto lhs = set->lhs;
+    if (!lhs || !state.reached) {
+      break;
+    }
+    if (lhs->kind() == AST::VariableN) {
+      auto sym = &((Variable *)lhs)->getSymbol();
+      if (stmt->kind() == AST::SetAppendN) {
+        // appended in place when already a list
+        k = Value::List;
+      } else if (stmt->kind() == AST::SetConcatN) {
+        // appended in place when already a string
+        k = join(k, Value::String);
+      }
+      state.kinds[sym] = k;
+    } else if (auto b = lhs->isOp(Binary::SUBSCRIPT)) {
+      expression(b->right, state);
+      state.kinds[&((Variable *)b->left)->getSymbol()] = ANY;
+    } else {
+      // an assignment by name may reach any variable
+      expression(lhs, state);
+      for (auto &v : state.kinds) {
+        v.second = ANY;
+      }
+      state.others = ANY;
+    }
+    break;
+  }
+  default:
+    operands(stmt, state);
+    break;
+  }
+}
+
+// the expressions of a statement that assigns no variables
+void KindInference::operands(Statement *stmt, const Kinds &state) {
+  auto use = [this, &state](Expression *e) {
+    if (e) {
+      expression(e, state);
+    }
+  };
+  switch (stmt->kind()) {
+  case AST::InputN:
+  case AST::CloseN:
+  case AST::OutputN:
+    use(((IOStmt *)stmt)->buffer);
+    break;
+  case AST::PrintN:
+    use(((Print *)stmt)->text);
+    use(((Print *)stmt)->buffer);
+    break;
+  case AST::ReplaceN:
+    use(((Replace *)stmt)->pattern);
+    use(((Replace *)stmt)->replacement);
+    break;
+  case AST::SplitN:
+    use(((Split *)stmt)->separator);
+    use(((Split *)stmt)->target);
+    break;
+  case AST::ColumnsN:
+    use(((Columns *)stmt)->columns);
+    use(((Columns *)stmt)->inExpr);
+    break;
+  case AST::RequiredN:
+    use(((Required *)stmt)->predicate);
+    use(((Required *)stmt)->errMsg);
+    break;
+  case AST::StopN:
+  case AST::ErrorN:
+    use(((Stop *)stmt)->text);
+    break;
+  default:
+    break;
+  }
+}
+
+void KindInference::infer(Statement *script) {
+  Kinds state;
+  record = true;
+  statements(script, state);
+  // a use reached with different kinds has none
+  for (auto &u : uses) {
+    u.first->setKind(u.second >= 0, Value::Kind(u.second >= 0 ? u.second : 0));
+  }
+}
+
+// Decides whether a script is a pure per line transform: assignments
+// followed by a foreach over all lines whose iterations share no state.
+// Chunks of the input may then be run separately, each from the script's
+// initial state, and their output concatenated.
+class LineIndependence {
+  // the variables the loop assigns, and those already assigned in this
+  // iteration before any use
+  unordered_set<Symbol *> assigned;
+  unordered_set<Symbol *> killed;
+  bool independent = true;
+
+  void use(Symbol *symbol) {
+    if (assigned.count(symbol) && !killed.count(symbol)) {
+      // the value may come from an earlier line
+      independent = false;
+    }
+  }
+  void expression(Expression *e, bool inLoop, bool matched);
+  void statements(Statement *list, bool top, bool matched);
+
+public:
+  bool check(Statement *script);
+};
+
+// 'matched' is set when $1... were set on this line, by a split or by
+// the match of an enclosing if
+void LineIndependence::expression(Expression *e, bool inLoop, bool matched) {
+  if (!e) {
+    return;
+  }
+  e->walkDown([this, inLoop, matched](Expression *e) {
+    switch (e->kind()) {
+    case AST::VariableN: {
+      auto symbol = &((Variable *)e)->getSymbol();
+      if (!inLoop && symbol->isDynamic()) {
+        // $CURRENT and friends before the loop read the first line
+        independent = false;
+      }
+      use(symbol);
+      break;
+    }
+    case AST::VarMatchN:
+      independent &= matched;
+      break;
+    case AST::BinaryN:
+      // names computed at run time may be any variable
+      independent &= !((Binary *)e)->isOp(Binary::LOOKUP);
+      break;
+    case AST::CallN:
+      switch (((Call *)e)->getCallId()) {
+      case BuiltinCalls::SHELL:
+      case BuiltinCalls::MKTEMP:
+      case BuiltinCalls::EXPAND:
+        independent = false;
+        break;
+      default:
+        break;
+      }
+      break;
+    default:
+      break;
+    }
+    return (independent ? AST::ContinueW : AST::StopW);
+  });
+}
+
+void LineIndependence::statements(Statement *list, bool top, bool matched) {
+  for (auto s = list; s && independent; s = s->getNext()) {
+    switch (s->kind()) {
+    case AST::SkipN:
+    case AST::CopyN:
+      break;
+    case AST::PrintN:
+      // output to files would be written out of order
+      independent &= !((Print *)s)->buffer;
+      expression(((Print *)s)->text, true, matched);
+      break;
+    case AST::ReplaceN:
+      expression(((Replace *)s)->pattern, true, matched);
+      expression(((Replace *)s)->replacement, true, matched);
+      break;
+    case AST::SplitN:
+      expression(((Split *)s)->separator, true, matched);
+      expression(((Split *)s)->target, true, matched);
+      matched = true;
+      break;
+    case AST::ColumnsN:
+      expression(((Columns *)s)->columns, true, matched);
+      expression(((Columns *)s)->inExpr, true, matched);
+      matched = true;
+      break;
+    case AST::ErrorN:
+      expression(((Stop *)s)->text, true, matched);
+      break;
+    case AST::IfStmtN: {
+      auto i = (IfStatement *)s;
+      expression(i->predicate, true, matched);
+      statements(i->thenStmts, false,
+                 matched || i->predicate->isOp(Binary::MATCH));
+      statements(i->elseStmts, false, matched);
+      break;
+    }
+    case AST::SetN:
+    case AST::SetAppendN:
+    case AST::SetConcatN: {
+      auto set = (Set *)s;
+      expression(set->rhs, true, matched);
+      if (auto b = set->lhs->isOp(Binary::SUBSCRIPT)) {
+        // an element update keeps the rest of the value
+        expression(b->right, true, matched);
+        use(&((Variable *)b->left)->getSymbol());
+      } else if (top && s->kind() == AST::SetN) {
+        killed.insert(&((Variable *)set->lhs)->getSymbol());
+      }
+      break;
+    }
+    default:
+      // nested loops, input and output switching, stop and required
+      independent = false;
+      break;
+    }
+  }
+}
+
+bool LineIndependence::check(Statement *script) {
+  auto s = script;
+  for (; s && s->kind() == AST::SetN; s = s->getNext()) {
+    auto set = (Set *)s;
+    independent &= set->lhs->kind() == AST::VariableN;
+    expression(set->rhs, false, false);
+  }
+  if (!independent || !s || s->kind() != AST::ForeachN || s->getNext() ||
+      ((Foreach *)s)->control) {
+    return false;
+  }
+  auto body = ((Foreach *)s)->body;
+  body->walk([this](Statement *s) {
+    if (auto set = isa<Set>(s)) {
+      auto lhs = set->lhs;
+      if (auto b = lhs->isOp(Binary::SUBSCRIPT)) {
+        lhs = b->left;
+      }
+      if (lhs->kind() == AST::VariableN) {
+        assigned.insert(&((Variable *)lhs)->getSymbol());
+      } else {
+        independent = false;
+      }
+    }
+    return AST::ContinueW;
+  });
+  statements(body, true, false);
+  return independent;
+}
 }
 
 namespace Optimize {
@@ -62,13 +788,33 @@ Statement *optimize(Statement *input) {
   if (!FLAGS_optimize) {
     return input;
   }
+  foldConstants(input);
+  sharePatterns(input);
   Optimizer opt;
   auto out = opt.optimize(input);
-  if (RSED::dump) {
+  KindInference().infer(out);
+  if (Context::current()->dump) {
     out->dump();
   }
   return out;
 }
+
+bool lineIndependent(Statement *script) {
+  return LineIndependence().check(script);
+}
+
+bool writesFiles(Statement *script) {
+  bool writes = false;
+  script->walk([&writes](Statement *stmt) {
+    if (stmt->kind() == AST::OutputN ||
+        (stmt->kind() == AST::PrintN && ((Print *)stmt)->buffer)) {
+      writes = true;
+      return AST::StopW;
+    }
+    return AST::ContinueW;
+  });
+  return writes;
+}
 }
 
 Statement *Optimizer::optimize(Statement *input) {
@@ -83,7 +829,7 @@ Statement *Optimizer::optimize(Statement *input) {
     hoistInvariants(&foreach->control);
     hoistInvariants(newBody);
     foreach
-      ->body = newBody;
+      ->body = dropRehoisted(newBody);
     if (lastInvariant) {
       lastInvariant->setNext(foreach);
       return firstInvariant;
@@ -91,6 +837,25 @@ Statement *Optimizer::optimize(Statement *input) {
     return foreach;
   }
   if (auto ifstmt = isa<IfStatement>(input)) {
+    // a constant predicate selects one branch; an empty selection is
+    // kept when it is all that is left of a statement list
+    Value predicate;
+    auto next = ifstmt->getNext();
+    if (isConstant(ifstmt->predicate, &predicate) &&
+        (next || (predicate.asLogical() ? ifstmt->thenStmts
+                                        : ifstmt->elseStmts))) {
+      auto taken = optimize(predicate.asLogical() ? ifstmt->thenStmts
+                                                  : ifstmt->elseStmts);
+      if (!taken) {
+        return next;
+      }
+      auto last = taken;
+      while (last->getNext()) {
+        last = last->getNext();
+      }
+      last->setNext(next);
+      return taken;
+    }
     ifstmt->thenStmts = optimize(ifstmt->thenStmts);
     ifstmt->elseStmts = optimize(ifstmt->elseStmts);
     return ifstmt;
@@ -109,20 +874,43 @@ Statement *Optimizer::optimize(Statement *input) {
         return a;
       }
     }
+    // x = $x ....
+    if (lhs->kind() == AST::VariableN && set->rhs->isOp(Binary::CONCAT)) {
+      auto first = set->rhs;
+      while (auto c = first->isOp(Binary::CONCAT)) {
+        first = c->left;
+      }
+      if (lhs->same(first)) {
+        auto a = new SetConcat(set);
+        a->setNext(set->getNext());
+        delete set;
+        return a;
+      }
+    }
   }
   return input;
 }
 
 void Optimizer::noteSetVariables(Statement *body) {
   setInLoop.clear();
+  setByName.clear();
   unknownSymbolSet = false;
   body->walk([this](Statement *stmt) {
-    if (auto set = isa<Set>(stmt)) {
+    auto set = isa<Set>(stmt);
+    if (!set && (isa<SetAppend>(stmt) || isa<SetConcat>(stmt))) {
+      set = (Set *)stmt;
+    }
+    if (set) {
       auto lhs = set->lhs;
       if (lhs) {
+        if (auto b = lhs->isOp(Binary::SUBSCRIPT)) {
+          lhs = b->left;
+        }
         if (lhs->kind() == lhs->VariableN) {
           auto sym = &((Variable *)lhs)->getSymbol();
           setInLoop.insert(sym);
+        } else if (auto b = lhs->isOp(Binary::LOOKUP)) {
+          noteSetByName(b->right);
         } else {
           unknownSymbolSet = true;
           return AST::StopW;
@@ -133,6 +921,73 @@ void Optimizer::noteSetVariables(Statement *body) {
   });
 }
 
+// an assignment through $(name) can only write variables whose names
+// begin and end with the constant text of the name expression
+void Optimizer::noteSetByName(Expression *name) {
+  vector<Expression *> terms;
+  name->walkConcat([&terms](Expression *t) { terms.push_back(t); });
+  auto text = [](Expression *t, std::string *s) {
+    Value v;
+    if (!isConstant(t, &v)) {
+      return false;
+    }
+    *s = v.asString().str();
+    return true;
+  };
+  NameSet names{"", "", true};
+  std::string s;
+  auto first = terms.begin(), last = terms.end();
+  for (; first != last && text(*first, &s); ++first) {
+    names.prefix += s;
+  }
+  if (first != last) {
+    names.exact = false;
+    for (; last != first && text(last[-1], &s); --last) {
+      names.suffix.insert(0, s);
+    }
+  }
+  setByName.push_back(names);
+}
+
+bool Optimizer::isInvariant(Symbol *sym) {
+  if (unknownSymbolSet || sym->isDynamic() || setInLoop.count(sym)) {
+    return false;
+  }
+  auto &name = sym->getName();
+  for (auto &n : setByName) {
+    if (n.exact ? name == n.prefix
+                : (name.size() >= n.prefix.size() + n.suffix.size() &&
+                   name.compare(0, n.prefix.size(), n.prefix) == 0 &&
+                   name.compare(name.size() - n.suffix.size(),
+                                n.suffix.size(), n.suffix) == 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// An invariant of an inner loop is evaluated just before it. When that
+// is hoisted again, out of this loop, the evaluation left in the body
+// does nothing and is removed.
+Statement *Optimizer::dropRehoisted(Statement *list) {
+  if (!list) {
+    return list;
+  }
+  list->setNext(dropRehoisted(list->getNext()));
+  if (auto set = isa<Set>(list)) {
+    if (!set->lhs && set->rhs->kind() == AST::HoistedValueRefN) {
+      auto next = set->getNext();
+      delete set;
+      return next;
+    }
+  } else if (auto ifstmt = isa<IfStatement>(list)) {
+    // a branch left empty is null, as for 'if ... then end'
+    ifstmt->thenStmts = dropRehoisted(ifstmt->thenStmts);
+    ifstmt->elseStmts = dropRehoisted(ifstmt->elseStmts);
+  }
+  return list;
+}
+
 void Optimizer::hoistInvariants(Statement *body) {
   body->applyExprs(/*recurseIntoForeach*/ false,
                    [this](Expression *&expr) { hoistInvariants(&expr); });
@@ -243,6 +1098,7 @@ HoistInfo Optimizer::checkHoist(Expression **exprHome) {
     assert(0 && "unexpected hoistvalueref type");
     break;
   case AST::ListN:
+  case AST::MapN:
   case AST::CallN: {
     std::vector<HoistInfo> args;
     bool invariant = true;
@@ -346,7 +1202,7 @@ HoistInfo Optimizer::checkHoist(Expression **exprHome) {
 
 void Optimizer::hoist(Expression **expr) {
   auto e = *expr;
-  if (RSED::debug) {
+  if (Context::current()->debug) {
     std::cout << "hoiosting: ";
     e->dump();
     std::cout << "\n";
@@ -12,6 +12,11 @@
 class Statement;
 namespace Optimize {
 Statement *optimize(Statement *input);
+// true for a script (before optimization) whose lines may be processed
+// independently: a foreach over all lines whose iterations share no state
+bool lineIndependent(Statement *script);
+// true for a script that prints to or switches its output to a file
+bool writesFiles(Statement *script);
 }
 
 #endif /* Optimize_hpp */
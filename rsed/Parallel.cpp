@@ -0,0 +1,264 @@
+//
+//  Parallel.cpp
+//  rsed
+//
+
+#include "Parallel.h"
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "LineBuffer.h"
+#include "librsed.h"
+
+using rsed::Script;
+
+namespace {
+
+// work for the pool, run by a worker with its own copy of the script
+struct Job {
+  std::string output;
+  std::string error;
+  bool failed = false;
+  bool done = false;
+
+  virtual ~Job() {}
+  virtual void run(Script &script) = 0;
+};
+
+struct Chunk : Job {
+  // the lines, each ending in '\n', and the number before them
+  std::string text;
+  unsigned linesBefore = 0;
+  unsigned lines = 0;
+
+  void run(Script &script) override;
+};
+
+void Chunk::run(Script &script) {
+  size_t next = 0;
+  auto read = [this, &next](std::string &line) {
+    if (next >= text.size()) {
+      return false;
+    }
+    auto end = text.find('\n', next);
+    line.assign(text, next, end - next);
+    next = end + 1;
+    return true;
+  };
+  auto write = [this](const char *text, size_t length) {
+    output.append(text, length);
+  };
+  script.setLinesBefore(linesBefore);
+  failed = !script.run(read, write, &error);
+}
+
+// an input file of a batch; its output goes to the file's name plus
+// 'suffix' or, without a suffix, is kept to be written in order
+struct File : Job {
+  std::string name;
+  std::string suffix;
+
+  void run(Script &script) override;
+};
+
+void File::run(Script &script) {
+  std::ifstream in(name);
+  if (!in) {
+    failed = true;
+    error = "unable to open input\n";
+    return;
+  }
+  std::ofstream out;
+  if (!suffix.empty()) {
+    out.open(name + suffix);
+    if (!out) {
+      failed = true;
+      error = "unable to open output " + name + suffix + '\n';
+      return;
+    }
+  }
+  auto read = [&in](std::string &line) {
+    return bool(std::getline(in, line));
+  };
+  auto write = [this, &out](const char *text, size_t length) {
+    if (out.is_open()) {
+      out.write(text, length);
+    } else {
+      output.append(text, length);
+    }
+  };
+  script.setLinesBefore(0);
+  script.setInputName(name);
+  failed = !script.run(read, write, &error);
+}
+
+class Pool {
+  std::mutex mutex;
+  // signaled when a job is queued or the pool is closing
+  std::condition_variable queued;
+  // signaled when a job is done
+  std::condition_variable finished;
+  std::deque<Job *> queue;
+  bool closing = false;
+  std::vector<std::thread> workers;
+
+  void work(Script *script);
+
+public:
+  explicit Pool(const std::vector<std::unique_ptr<Script>> &scripts);
+  ~Pool();
+  void add(Job *job);
+  void wait(Job *job);
+};
+
+Pool::Pool(const std::vector<std::unique_ptr<Script>> &scripts) {
+  for (auto &s : scripts) {
+    workers.emplace_back(&Pool::work, this, s.get());
+  }
+}
+
+Pool::~Pool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+    queue.clear();
+  }
+  queued.notify_all();
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+void Pool::add(Job *job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(job);
+  }
+  queued.notify_one();
+}
+
+void Pool::wait(Job *job) {
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [job]() { return job->done; });
+}
+
+void Pool::work(Script *script) {
+  for (;;) {
+    Job *job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queued.wait(lock, [this]() { return closing || !queue.empty(); });
+      if (closing) {
+        return;
+      }
+      job = queue.front();
+      queue.pop_front();
+    }
+    job->run(*script);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job->done = true;
+    }
+    finished.notify_all();
+  }
+}
+
+// each worker has its own copy of the script, with its own symbols,
+// files and regular expressions; false if the script is invalid
+bool compile(const std::string &text, const std::vector<std::string> &args,
+             unsigned threads, std::vector<std::unique_ptr<Script>> *scripts) {
+  for (unsigned t = 0; t < threads; t++) {
+    std::string errors;
+    auto script = Script::compile(text, &errors, args);
+    if (!script) {
+      std::cerr << errors;
+      return false;
+    }
+    scripts->push_back(std::move(script));
+  }
+  return true;
+}
+}
+
+int runParallel(const std::string &text, const std::vector<std::string> &args,
+                LineBuffer &input, LineBuffer &output, unsigned threads,
+                size_t chunkSize) {
+  std::vector<std::unique_ptr<Script>> scripts;
+  if (!compile(text, args, threads, &scripts)) {
+    return 1;
+  }
+
+  // the chunks given to the pool, in input order; they outlive the pool
+  // so a worker may finish one after an error ends the run
+  std::deque<std::unique_ptr<Chunk>> pending;
+  Pool pool(scripts);
+  unsigned lines = 0;
+  bool more = true;
+  while (more || !pending.empty()) {
+    while (more && pending.size() < 2 * threads) {
+      std::unique_ptr<Chunk> chunk(new Chunk);
+      chunk->linesBefore = lines;
+      while (chunk->text.size() < chunkSize && (more = input.nextLine())) {
+        auto &line = input.getInputLine();
+        chunk->text.append(line.data(), line.length());
+        chunk->text += '\n';
+        chunk->lines++;
+      }
+      if (!chunk->lines) {
+        break;
+      }
+      lines += chunk->lines;
+      pool.add(chunk.get());
+      pending.push_back(std::move(chunk));
+    }
+    if (pending.empty()) {
+      break;
+    }
+    auto &chunk = *pending.front();
+    pool.wait(&chunk);
+    output.appendString(chunk.output);
+    if (chunk.failed) {
+      std::cerr << chunk.error;
+      return 1;
+    }
+    pending.pop_front();
+  }
+  return 0;
+}
+
+int runBatch(const std::string &text, const std::vector<std::string> &args,
+             const std::vector<std::string> &files, const std::string &suffix,
+             LineBuffer &output, unsigned threads) {
+  std::vector<std::unique_ptr<Script>> scripts;
+  if (!compile(text, args, threads, &scripts)) {
+    return 1;
+  }
+
+  std::deque<std::unique_ptr<File>> pending;
+  Pool pool(scripts);
+  int rc = 0;
+  size_t next = 0;
+  while (next < files.size() || !pending.empty()) {
+    while (next < files.size() && pending.size() < 2 * threads) {
+      std::unique_ptr<File> file(new File);
+      file->name = files[next++];
+      file->suffix = suffix;
+      pool.add(file.get());
+      pending.push_back(std::move(file));
+    }
+    // an error ends only its own file
+    auto &file = *pending.front();
+    pool.wait(&file);
+    output.appendString(file.output);
+    if (file.failed) {
+      std::cerr << file.name << ": " << file.error;
+      rc = 1;
+    }
+    pending.pop_front();
+  }
+  return rc;
+}
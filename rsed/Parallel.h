@@ -0,0 +1,35 @@
+//
+//  Parallel.h
+//  rsed
+//
+
+#ifndef Parallel_h
+#define Parallel_h
+#include <string>
+#include <vector>
+
+class LineBuffer;
+
+// Runs a script whose lines are independent (Optimize::lineIndependent)
+// on a pool of threads: the input is read in chunks of about 'chunkSize'
+// bytes, each chunk is run from the script's initial state by a worker
+// with its own copy of the script, and the outputs are written in input
+// order. An error ends the run after the output of the lines before it,
+// as it would running serially. Returns the exit code.
+int runParallel(const std::string &text, const std::vector<std::string> &args,
+                LineBuffer &input, LineBuffer &output, unsigned threads,
+                size_t chunkSize);
+
+// Runs a script over each of 'files' on a pool of threads, each file from
+// the script's initial state as if it were the input of its own run. The
+// output of a file is written to its name plus 'suffix' or, if 'suffix'
+// is empty, to 'output' in the order of 'files'. An error, reported with
+// the name of its file, ends only that file. Each thread has its own
+// files, so a script that writes files by name is run on one thread, whose
+// files are shared by the runs in the order of 'files'. Returns the exit
+// code.
+int runBatch(const std::string &text, const std::vector<std::string> &args,
+             const std::vector<std::string> &files, const std::string &suffix,
+             LineBuffer &output, unsigned threads);
+
+#endif /* Parallel_h */
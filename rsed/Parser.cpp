@@ -13,13 +13,26 @@
 int yyparse(Statement **parseTree, Scanner *scanner);
 extern int yydebug;
 
+namespace {
+Statement *parseScript(Scanner &s) {
+  Statement *result = nullptr;
+  auto rv = yyparse(&result, &s);
+  return (rv || s.sawError ? nullptr : result);
+}
+}
+
 Statement *Parser::parse(const std::string &script) {
   // yydebug = 1;
   Scanner s;
   if (!s.init(script.c_str())) {
     return nullptr;
   }
-  Statement *result = nullptr;
-  auto rv = yyparse(&result, &s);
-  return (rv || s.sawError ? nullptr : result);
+  return parseScript(s);
+}
+
+Statement *Parser::parse(std::istream &script, std::ostream &errors) {
+  Scanner s;
+  s.init(&script);
+  s.errors = &errors;
+  return parseScript(s);
 }
\ No newline at end of file
@@ -9,9 +9,15 @@
 #ifndef rsed_Parser_h
 #define rsed_Parser_h
 
+#include <iostream>
+#include <string>
+
 class Parser {
 public:
+  // parse the named script file, or the standard input if empty
   class Statement *parse(const std::string &);
+  // parse script text, reporting syntax errors to 'errors'
+  class Statement *parse(std::istream &script, std::ostream &errors);
 };
 
 #endif
@@ -12,6 +12,7 @@
 #include <string>
 #include <cstring>
 #include <exception>
+#include <iterator>
 #include "StringRef.h"
 #include "RegEx.h"
 #include "Exception.h"
@@ -26,32 +27,43 @@ extern int debug;
 namespace {
 
 class C14RegEx : public RegEx {
-  static syntax_option_type regExOptions;
-  static bool specials[];
-  std::vector<std::pair<std::regex, StringPtr>> patterns;
-  std::smatch matches;
-  std::string lastTarget;
+  syntax_option_type regExOptions = ECMAScript;
+  bool specials[256];
+  struct Pattern {
+    std::regex regex;
+    StringRef text;
+    bool compiled = false;
+    // The last text searched and what was found. A loop body often tests
+    // the same line against one pattern in several statements, so a
+    // search of the same text again reuses the result and submatches.
+    StringRef target;
+    bool searched = false;
+    bool found = false;
+    // offset and length in target of each submatch
+    std::vector<std::pair<size_t, size_t>> groups;
+  };
+  std::vector<Pattern> patterns;
+  // the pattern whose submatches are $1, $2, ...
+  int lastPattern = -1;
 
 public:
   virtual int setStyle(const std::string &style) override;
-  virtual void setPattern(StringPtr pattern, int index) override;
+  virtual void setPattern(StringRef pattern, int index) override;
 
-  virtual bool match(int pattern, const std::string &line) override;
-  virtual void match(int pattern, const std::string &line,
-                     std::vector<std::string> *list) override;
-  virtual void split(int pattern, const std::string &target,
-                     std::vector<std::string> *words) override;
+  virtual bool match(int pattern, const StringRef &line) override;
+  virtual void match(int pattern, const StringRef &line,
+                     std::vector<StringRef> *list, size_t limit) override;
+  virtual void split(int pattern, const StringRef &target,
+                     std::vector<StringRef> *words, size_t limit) override;
   virtual std::string escape(const std::string &text) override;
-  virtual std::string getSubMatch(unsigned i) override;
-  virtual std::string replace(int pattern, const std::string &replacement,
-                              const std::string &line) override;
+  virtual StringRef getSubMatch(unsigned i) override;
+  virtual StringRef replace(int pattern, const StringRef &replacement,
+                            const StringRef &line) override;
 };
 
-syntax_option_type C14RegEx::regExOptions = ECMAScript;
-
-std::regex createRegex(const string &str, syntax_option_type options) {
+std::regex createRegex(const StringRef &str, syntax_option_type options) {
   try {
-    std::regex temp(str,options);
+    std::regex temp(str.begin(), str.end(), options);
     return temp;
   } catch (std::exception &) {
     throw Exception("invalid regular expression: " + str);
@@ -59,44 +71,69 @@ std::regex createRegex(const string &str, syntax_option_type options) {
 }
 }
 
-bool C14RegEx::specials[256];
-RegEx *RegEx::regEx = nullptr;
-std::string RegEx::styleName;
-
-bool C14RegEx::match(int pattern, const std::string &line) {
-  lastTarget = line;
-  return std::regex_search(lastTarget, matches, patterns[pattern].first);
+bool C14RegEx::match(int pattern, const StringRef &line) {
+  auto &p = patterns[pattern];
+  lastPattern = pattern;
+  if (p.searched && p.target.length() == line.length() &&
+      (p.target.data() == line.data() || p.target == line)) {
+    return p.found;
+  }
+  p.target = line;
+  p.searched = true;
+  p.groups.clear();
+  std::cmatch matches;
+  p.found = std::regex_search(p.target.begin(), p.target.end(), matches,
+                              p.regex);
+  for (auto &m : matches) {
+    if (m.matched) {
+      p.groups.emplace_back(m.first - p.target.begin(), m.length());
+    } else {
+      p.groups.emplace_back(0, 0);
+    }
+  }
+  return p.found;
 }
 
-std::string C14RegEx::getSubMatch(unsigned int i) {
-  if (i >= matches.size()) {
-    return "";
+StringRef C14RegEx::getSubMatch(unsigned int i) {
+  if (lastPattern < 0 || i >= patterns[lastPattern].groups.size()) {
+    return StringRef();
   }
-  return matches[i];
+  auto &p = patterns[lastPattern];
+  return p.target.slice(p.groups[i].first, p.groups[i].second);
 }
 
-void C14RegEx::match(int pattern, const std::string &line,
-                     std::vector<std::string> *list) {
+void C14RegEx::match(int pattern, const StringRef &line,
+                     std::vector<StringRef> *list, size_t limit) {
 
-  typedef std::regex_iterator<std::string::const_iterator> Iterator;
+  typedef std::regex_iterator<const char *> Iterator;
   Iterator end;
-  Iterator next(line.begin(), line.end(), patterns[pattern].first);
-  for ( ; next != end; ++next) {
-    list->push_back(next->str());
+  Iterator next(line.begin(), line.end(), patterns[pattern].regex);
+  for (size_t n = 0; next != end && n < limit; ++next, n++) {
+    auto &m = (*next)[0];
+    list->push_back(line.slice(m.first - line.begin(), m.length()));
   }
 }
 
 
-void C14RegEx::setPattern(StringPtr pattern, int index) {
+void C14RegEx::setPattern(StringRef pattern, int index) {
   if (index >= patterns.size()) {
     patterns.resize(2 * index + 1);
   }
-  syntax_option_type options = C14RegEx::regExOptions;
-  if (pattern->getFlags() & pattern->CASE_INSENSITIVE) {
+  auto &p = patterns[index];
+  // a pattern that is not hoisted is set each time it is evaluated, keep
+  // the compiled form (and the last search) when it has not changed
+  if (p.compiled && p.text == pattern &&
+      p.text.getFlags() == pattern.getFlags()) {
+    return;
+  }
+  syntax_option_type options = regExOptions;
+  if (pattern.getFlags() & pattern.CASE_INSENSITIVE) {
     options |= icase;
   }
-  auto regex = createRegex(pattern->getText(), options);
-  patterns[index] = std::make_pair(std::move(regex) , std::move(pattern));
+  p.regex = createRegex(pattern, options);
+  p.text = std::move(pattern);
+  p.compiled = true;
+  p.searched = false;
 }
 
 std::string C14RegEx::escape(const std::string &text) {
@@ -107,12 +144,13 @@ std::string C14RegEx::escape(const std::string &text) {
     }
     result.append(1, c);
   }
-  return std::move(result);
+  return result;
 }
 
-void RegEx::setDefaultRegEx() {
-  regEx = new C14RegEx;
+std::unique_ptr<RegEx> RegEx::makeDefaultRegEx() {
+  std::unique_ptr<RegEx> regEx(new C14RegEx);
   regEx->setStyle("ECMAScript");
+  return regEx;
 }
 
 // maybe thos should not be in C14RegEx but rather used
@@ -145,24 +183,25 @@ int C14RegEx::setStyle(const std::string &style) {
   return 0;
 }
 
-std::string C14RegEx::replace(int pattern, const std::string &replacement,
-                              const std::string &line) {
-  std::regex &re = patterns[pattern].first;
-  unsigned flags = patterns[pattern].second->getFlags();
-  if (flags & StringRef::GLOBAL) {
-    return std::regex_replace(line, re, replacement);
-  }
-  return std::regex_replace(line, re, replacement, format_first_only);
+StringRef C14RegEx::replace(int pattern, const StringRef &replacement,
+                            const StringRef &line) {
+  std::regex &re = patterns[pattern].regex;
+  unsigned flags = patterns[pattern].text.getFlags();
+  auto format = (flags & StringRef::GLOBAL ? format_default : format_first_only);
+  string result;
+  std::regex_replace(std::back_inserter(result), line.begin(), line.end(), re,
+                     replacement.str(), format);
+  return StringRef(result);
 }
 
-void C14RegEx::split(int pattern, const std::string &target,
-                     std::vector<std::string> *words) {
+void C14RegEx::split(int pattern, const StringRef &target,
+                     std::vector<StringRef> *words, size_t limit) {
   assert(pattern < patterns.size());
-  std::sregex_token_iterator iter(target.begin(), target.end(),
-                                  patterns[pattern].first, -1);
-  std::sregex_token_iterator end;
-  for (; iter != end; ++iter) {
-    std::string p = *iter;
-    words->emplace_back(std::move(p));
+  std::cregex_token_iterator iter(target.begin(), target.end(),
+                                  patterns[pattern].regex, -1);
+  std::cregex_token_iterator end;
+  for (size_t n = 0; iter != end && n < limit; ++iter, n++) {
+    auto &p = *iter;
+    words->push_back(target.slice(p.first - target.begin(), p.length()));
   }
 }
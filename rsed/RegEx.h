@@ -8,38 +8,44 @@
 
 #ifndef __rsed__RegEx__
 #define __rsed__RegEx__
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <regex>
 #include "StringRef.h"
 
 class RegEx {
 protected:
-  static std::string styleName;
+  std::string styleName;
 
 public:
+  virtual ~RegEx() {}
   // set once and govens the entire script
   virtual int setStyle(const std::string &style) = 0;
 
   // compile a pattern which is then referred to by index
-  virtual void setPattern(StringPtr, int index) = 0;
+  virtual void setPattern(StringRef, int index) = 0;
 
   // perform a replacement operation
-  virtual std::string replace(int pattern, const std::string &replacement,
-                              const std::string &line) = 0;
-  virtual bool match(int pattern, const std::string &line) = 0;
-  virtual void match(int pattern, const std::string &line,
-                     std::vector<std::string> *list) = 0;
-  virtual void split(int pattern, const std::string &target,
-                     std::vector<std::string> *words) = 0;
+  virtual StringRef replace(int pattern, const StringRef &replacement,
+                            const StringRef &line) = 0;
+  virtual bool match(int pattern, const StringRef &line) = 0;
+  // the matches in 'line', or the words between them with split; both
+  // stop once they have 'limit' of them
+  virtual void match(int pattern, const StringRef &line,
+                     std::vector<StringRef> *list,
+                     size_t limit = SIZE_MAX) = 0;
+  virtual void split(int pattern, const StringRef &target,
+                     std::vector<StringRef> *words,
+                     size_t limit = SIZE_MAX) = 0;
 
   virtual std::string escape(const std::string &text) = 0;
 
   // return a group by nnumber
-  virtual std::string getSubMatch(unsigned i) = 0;
+  virtual StringRef getSubMatch(unsigned i) = 0;
 
-  static RegEx *regEx;
-  static void setDefaultRegEx();
-  static const std::string &getStyleName() { return styleName; }
+  static std::unique_ptr<RegEx> makeDefaultRegEx();
+  const std::string &getStyleName() const { return styleName; }
 };
 
 #endif /* defined(__rsed__RegEx__) */
@@ -0,0 +1,67 @@
+//
+//  Ring.h
+//  rsed
+//
+
+#ifndef Ring_h
+#define Ring_h
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+
+// A fixed size queue between one producer thread and one consumer thread,
+// without locks: only the producer moves 'tail' and only the consumer
+// moves 'head'. push and pop return false rather than wait when the ring
+// is full or empty.
+template <typename T, size_t Size> class Ring {
+  static_assert((Size & (Size - 1)) == 0, "ring size must be a power of 2");
+  T slots[Size];
+  // the number of values popped and pushed
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+
+public:
+  bool push(T &value) {
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == Size) {
+      return false;
+    }
+    slots[t & (Size - 1)] = std::move(value);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  bool pop(T &value) {
+    auto h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = std::move(slots[h & (Size - 1)]);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+// waiting on a ring: yield to the other thread at first, then sleep,
+// twice as long each time up to MAX_SLEEP microseconds, so a thread
+// waiting on idle input neither takes a core nor wakes thousands of
+// times a second
+class Backoff {
+  enum { SPINS = 64, FIRST_SLEEP = 50, MAX_SLEEP = 4000 };
+  unsigned spins = 0;
+  unsigned sleep = FIRST_SLEEP;
+
+public:
+  void wait() {
+    if (++spins < SPINS) {
+      std::this_thread::yield();
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(sleep));
+    sleep = std::min<unsigned>(2 * sleep, MAX_SLEEP);
+  }
+};
+
+#endif /* Ring_h */
@@ -0,0 +1,580 @@
+//
+//  Runtime.h
+//  rsed
+//
+
+#ifndef Runtime_h
+#define Runtime_h
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Context.h"
+#include "AST.h"
+#include "Bytecode.h"
+#include "BuiltinCalls.h"
+#include "EvalState.h"
+#include "Exception.h"
+#include "LineBuffer.h"
+#include "RegEx.h"
+#include "Symbol.h"
+#include "Value.h"
+
+// The state of a running script: its input and output, the current line
+// and the registers of the compiled program.
+class State : public EvalState {
+  std::shared_ptr<LineBuffer> inputBuffer;
+
+  std::vector<std::shared_ptr<LineBuffer>> inputStack;
+  std::vector<std::shared_ptr<LineBuffer>> outputStack;
+
+public:
+  std::shared_ptr<LineBuffer> stdinBuffer;
+  std::shared_ptr<LineBuffer> stdoutBuffer;
+  // use columns are match for $1, $2,...
+  bool matchColumns = true;
+  std::vector<StringRef> columns;
+  // arguments of the builtin being called, reused across calls
+  std::vector<Value *> callArgs;
+  // the words of a split or match, reused across evaluations
+  std::vector<StringRef> words;
+  // the target of the print statement being executed
+  LineBuffer *printBuffer = nullptr;
+
+  // the registers of the running program and the per loop state: the
+  // remaining count and whether this is the last line
+  std::vector<Value> registers;
+  std::vector<unsigned> loopCounts;
+  std::vector<char> loopLast;
+
+  StringRef currentLine_;
+  bool needLine = true;
+  const StringRef &getCurrentLine() {
+    if (needLine) {
+      nextLine();
+    }
+    return currentLine_;
+  }
+
+  std::shared_ptr<LineBuffer> getInputBuffer() const { return inputBuffer; }
+  void pushInput(std::shared_ptr<LineBuffer> newInput) {
+    inputStack.push_back(std::move(inputBuffer));
+    resetInput(newInput);
+  }
+  void popInput() {
+    if (!inputStack.empty()) {
+      resetInput(inputStack.back());
+      inputStack.pop_back();
+    }
+  }
+  void pushOutput(std::shared_ptr<LineBuffer> newOutput) {
+    outputStack.push_back(std::move(outputBuffer));
+    outputBuffer = std::move(newOutput);
+  }
+  void popOutput() {
+    if (!outputStack.empty()) {
+      outputBuffer = outputStack.back();
+      outputStack.pop_back();
+    }
+  }
+  void releaseFiles() {
+    inputBuffer = nullptr;
+    outputBuffer = nullptr;
+    inputStack.clear();
+    outputStack.clear();
+  }
+  StringRef match(unsigned i) {
+    if (matchColumns) {
+      if (i >= columns.size()) {
+        return StringRef();
+      }
+      return columns[i];
+    } else {
+      return regEx->getSubMatch(i);
+    }
+  }
+  bool inputEof_ = false;
+  bool getInputEof() {
+    if (needLine) {
+      nextLine();
+    }
+    return inputEof_;
+  }
+  const StringRef &getInputLine() {
+    if (needLine) {
+      nextLine();
+    }
+    return inputBuffer->getInputLine();
+  }
+  void nextLine() {
+    if (!inputEof_) {
+      inputEof_ = !inputBuffer->nextLine();
+      currentLine_ = inputBuffer->getInputLine();
+      if (Context::current()->debug) {
+        std::cout << "input: " << currentLine_.str() << "\n";
+      }
+      needLine = false;
+    }
+  }
+  unsigned getLineno() const override {
+    return inputBuffer->getLineno() + unsigned(needLine);
+  }
+  void resetInput(const std::shared_ptr<LineBuffer> &newBuffer) {
+    needLine = true;
+    currentLine_.clear();
+    inputEof_ = false;
+    inputBuffer = newBuffer;
+  }
+
+  std::shared_ptr<LineBuffer> outputBuffer;
+
+  // set up the registers and loops of a program, returns the registers
+  Value *enter(const Bytecode::Program &program);
+  // run a program on the bytecode interpreter
+  void run(const Bytecode::Program &program);
+  bool runKernel(const Bytecode::Kernel &kernel, Value *registers);
+  void concat(Value *result, const unsigned *leaves, unsigned count,
+              Value *registers);
+  void getColumns(StringRef inExpr, const unsigned *cols, unsigned count,
+                  Value *registers, std::vector<StringRef> *columns);
+  void subscript(Value *result, Value *list, Value *key);
+  // the index a list subscript 'key' names
+  static unsigned listIndex(Value *key);
+  // result = words[index], or empty if there are not that many words
+  void wordAt(Value *result, unsigned index);
+  std::string requiredMessage(Value *pattern, Value *errMsg, unsigned flags);
+  void input(Value *value, bool shellCmd);
+  void close(Value *name, Close::Mode mode);
+
+  void print(Value *, LineBuffer &);
+  void printListElt(Value *v, const StringRef &sep, LineBuffer &out,
+                    bool first);
+
+  std::stringstream &expandVariables(const std::string &text,
+                                     std::stringstream &str) override;
+};
+
+// a script compiled to C++ by -emit_cpp: 'build' fills in the program
+// tables and 'run' executes it
+typedef void (*BuildScript)(Bytecode::Program &);
+typedef void (*RunScript)(State &, const Bytecode::Program &);
+
+// the main program of rsed and of scripts compiled with -emit_cpp
+int runScript(int argc, char *argv[]);
+int runCompiled(int argc, char *argv[], BuildScript build, RunScript run);
+
+namespace Bytecode {
+
+// The effect of each instruction, shared by the bytecode interpreter
+// (State::run) and scripts compiled to C++. Each takes the state, the
+// program, its registers and the instruction. Instructions that branch
+// return whether the branch is taken.
+
+inline bool execJUMP_IF_TRUE(State &, const Program &, Value *r,
+                             const Instruction &i) {
+  return r[i.a].asLogical();
+}
+inline bool execJUMP_IF_FALSE(State &, const Program &, Value *r,
+                              const Instruction &i) {
+  return !r[i.a].asLogical();
+}
+// returns the target of the case selected by r[a]
+inline unsigned execSWITCH(State &, const Program &p, Value *r,
+                           const Instruction &i) {
+  auto &table = p.switches[i.b];
+  auto it = table.cases.find(r[i.a].asString());
+  return (it == table.cases.end() ? table.otherwise : it->second);
+}
+inline void execTRACE(State &s, const Program &p, Value *,
+                      const Instruction &i) {
+  std::cout << "trace " << s.getInputBuffer()->getLineno() << ":";
+  p.source[&i - p.code.data()]->dumpOne();
+}
+inline void execLOAD_VAR(State &, const Program &p, Value *r,
+                         const Instruction &i) {
+  r[i.a].set(p.symbols[i.d]->getValue());
+}
+inline void execLOAD_MATCH(State &s, const Program &, Value *r,
+                           const Instruction &i) {
+  r[i.a].set(s.match(i.b));
+}
+inline void execCALL(State &s, const Program &p, Value *r,
+                     const Instruction &i) {
+  s.callArgs.clear();
+  for (unsigned k = 0; k < i.c; k++) {
+    s.callArgs.push_back(&r[p.operands[i.b + k]]);
+  }
+  BuiltinCalls::evalCall(i.d, s.callArgs, &s, &r[i.a]);
+}
+inline void execLIST(State &, const Program &p, Value *r,
+                     const Instruction &i) {
+  auto &l = r[i.a];
+  l.clearList();
+  for (unsigned k = 0; k < i.c; k++) {
+    l.append(r[p.operands[i.b + k]]);
+  }
+}
+inline void execMAP(State &, const Program &p, Value *r,
+                    const Instruction &i) {
+  auto &m = r[i.a];
+  m.clearMap();
+  for (unsigned k = 0; k < i.c; k += 2) {
+    auto key = r[p.operands[i.b + k]].asString();
+    m.mapInsert(key)->set(&r[p.operands[i.b + k + 1]]);
+  }
+}
+inline void execPATTERN(State &s, const Program &, Value *r,
+                        const Instruction &i) {
+  s.getRegEx()->setPattern(r[i.b].asString(), i.c);
+  r[i.a].setRegEx(i.c);
+}
+inline void execTEST(State &, const Program &, Value *r,
+                     const Instruction &i) {
+  r[i.a].set(r[i.b].asLogical());
+}
+inline void execNOT(State &, const Program &, Value *r,
+                    const Instruction &i) {
+  r[i.a].set(!r[i.b].asLogical());
+}
+inline void execLOOKUP(State &, const Program &, Value *r,
+                       const Instruction &i) {
+  r[i.a].set(Symbol::findSymbol(r[i.b].asString())->getValue());
+}
+inline void execCONCAT(State &s, const Program &p, Value *r,
+                       const Instruction &i) {
+  s.concat(&r[i.a], p.operands.data() + i.b, i.c, r);
+}
+inline void execMATCH(State &s, const Program &, Value *r,
+                      const Instruction &i) {
+  auto re = r[i.b].getRegEx();
+  auto &target = r[i.c].asString();
+  s.matchColumns = false;
+  r[i.a].set(s.getRegEx()->match(re, target));
+}
+inline void execMATCHES(State &s, const Program &, Value *r,
+                        const Instruction &i) {
+  s.getRegEx()->match(r[i.b].getRegEx(), r[i.c].asString(), &s.words);
+  r[i.a].set(&s.words);
+}
+// a subscript or the length of a list of matches, without the list: a
+// subscript stops searching once it has the match it needs
+inline void execMATCHES_AT(State &s, const Program &, Value *r,
+                           const Instruction &i) {
+  auto index = State::listIndex(&r[i.d]);
+  s.getRegEx()->match(r[i.b].getRegEx(), r[i.c].asString(), &s.words,
+                      size_t(index) + 1);
+  s.wordAt(&r[i.a], index);
+}
+inline void execMATCHES_LENGTH(State &s, const Program &, Value *r,
+                               const Instruction &i) {
+  s.getRegEx()->match(r[i.b].getRegEx(), r[i.c].asString(), &s.words);
+  r[i.a].set(double(s.words.size()));
+  s.words.clear();
+}
+inline void execREPLACE(State &s, const Program &, Value *r,
+                        const Instruction &i) {
+  auto re = r[i.b].getRegEx();
+  auto &input = r[i.c].asString();
+  r[i.a].set(s.getRegEx()->replace(re, r[i.d].asString(), input));
+}
+inline void execSET_GLOBAL(State &, const Program &, Value *r,
+                           const Instruction &i) {
+  auto sc = r[i.b].asString();
+  sc.setIsGlobal();
+  r[i.a].set(sc);
+}
+inline void execSPLIT(State &s, const Program &, Value *r,
+                      const Instruction &i) {
+  auto &text = r[i.b].asString();
+  s.getRegEx()->split(r[i.c].getRegEx(), text, &s.words);
+  r[i.a].set(&s.words);
+}
+// as with MATCHES_AT and MATCHES_LENGTH, but for the words of a split
+inline void execSPLIT_AT(State &s, const Program &, Value *r,
+                         const Instruction &i) {
+  auto &text = r[i.b].asString();
+  auto index = State::listIndex(&r[i.d]);
+  s.getRegEx()->split(r[i.c].getRegEx(), text, &s.words, size_t(index) + 1);
+  s.wordAt(&r[i.a], index);
+}
+inline void execSPLIT_LENGTH(State &s, const Program &, Value *r,
+                             const Instruction &i) {
+  auto &text = r[i.b].asString();
+  s.getRegEx()->split(r[i.c].getRegEx(), text, &s.words);
+  r[i.a].set(double(s.words.size()));
+  s.words.clear();
+}
+inline void execSPLIT_COLUMNS(State &s, const Program &p, Value *r,
+                              const Instruction &i) {
+  s.getColumns(r[i.d].asString(), p.operands.data() + i.b, i.c, r, &s.words);
+  r[i.a].set(&s.words);
+}
+inline void execEQ(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(equal(&r[i.b], &r[i.c]));
+}
+inline void execNE(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(!equal(&r[i.b], &r[i.c]));
+}
+inline void execLT(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(compare(&r[i.b], &r[i.c]) < 0);
+}
+inline void execLE(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(compare(&r[i.b], &r[i.c]) <= 0);
+}
+inline void execGE(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(compare(&r[i.b], &r[i.c]) >= 0);
+}
+inline void execGT(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(compare(&r[i.b], &r[i.c]) > 0);
+}
+inline void execADD(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(r[i.b].asNumber() + r[i.c].asNumber());
+}
+inline void execSUB(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(r[i.b].asNumber() - r[i.c].asNumber());
+}
+inline void execMUL(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(r[i.b].asNumber() * r[i.c].asNumber());
+}
+inline void execDIV(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(r[i.b].asNumber() / r[i.c].asNumber());
+}
+inline void execNEG(State &, const Program &, Value *r, const Instruction &i) {
+  r[i.a].set(-r[i.b].asNumber());
+}
+
+// the operands of these have kinds known when the script was compiled
+// (Expression::staticKind), so they need no conversion or dispatch
+#define RSED_NUMBER_OP(name, op)                                               \
+  inline void exec##name(State &, const Program &, Value *r,                   \
+                         const Instruction &i) {                               \
+    r[i.a].set(r[i.b].getNumber() op r[i.c].getNumber());                      \
+  }
+RSED_NUMBER_OP(EQ_NUM, ==)
+RSED_NUMBER_OP(NE_NUM, !=)
+RSED_NUMBER_OP(LT_NUM, <)
+RSED_NUMBER_OP(LE_NUM, <=)
+RSED_NUMBER_OP(GE_NUM, >=)
+RSED_NUMBER_OP(GT_NUM, >)
+RSED_NUMBER_OP(ADD_NUM, +)
+RSED_NUMBER_OP(SUB_NUM, -)
+RSED_NUMBER_OP(MUL_NUM, *)
+RSED_NUMBER_OP(DIV_NUM, /)
+#undef RSED_NUMBER_OP
+inline void execNEG_NUM(State &, const Program &, Value *r,
+                        const Instruction &i) {
+  r[i.a].set(-r[i.b].getNumber());
+}
+// a string operand makes compare() a string comparison
+inline void execEQ_STR(State &, const Program &, Value *r,
+                       const Instruction &i) {
+  r[i.a].set(r[i.b].asString() == r[i.c].asString());
+}
+inline void execNE_STR(State &, const Program &, Value *r,
+                       const Instruction &i) {
+  r[i.a].set(r[i.b].asString() != r[i.c].asString());
+}
+#define RSED_STRING_OP(name, op)                                               \
+  inline void exec##name(State &, const Program &, Value *r,                   \
+                         const Instruction &i) {                               \
+    r[i.a].set(r[i.b].asString().compare(r[i.c].asString()) op 0);             \
+  }
+RSED_STRING_OP(LT_STR, <)
+RSED_STRING_OP(LE_STR, <=)
+RSED_STRING_OP(GE_STR, >=)
+RSED_STRING_OP(GT_STR, >)
+#undef RSED_STRING_OP
+inline void execSUBSCRIPT(State &s, const Program &, Value *r,
+                          const Instruction &i) {
+  s.subscript(&r[i.a], &r[i.b], &r[i.c]);
+}
+inline void execSUBSCRIPT_VAR(State &s, const Program &p, Value *r,
+                              const Instruction &i) {
+  s.subscript(&r[i.a], p.symbols[i.d]->getValue(), &r[i.c]);
+}
+inline void execSET_VAR(State &, const Program &p, Value *r,
+                        const Instruction &i) {
+  p.symbols[i.d]->set(&r[i.a]);
+  if (Context::current()->debug) {
+    std::cout << "set to " << r[i.a] << '\n';
+  }
+}
+inline void execSET_LOOKUP(State &, const Program &, Value *r,
+                           const Instruction &i) {
+  auto &name = r[i.b];
+  if (!name.isString()) {
+    throw Exception("invalid symbol name " + name.asString());
+  }
+  Symbol::findSymbol(name.asString())->set(&r[i.a]);
+}
+inline void execSET_SUBSCRIPT(State &, const Program &p, Value *r,
+                              const Instruction &i) {
+  auto &symbol = *p.symbols[i.d];
+  auto value = symbol.getValue();
+  if (!symbol.isDynamic() && value->isString() &&
+      value->getString().empty()) {
+    value->clearMap();
+  }
+  if (symbol.isDynamic() || !value->isMap()) {
+    throw Exception("subscript assignment requires a map: " +
+                    symbol.getName());
+  }
+  auto key = r[i.b].asString();
+  value->mapInsert(key)->set(&r[i.a]);
+}
+inline bool execIF_NOT_LIST(State &, const Program &p, Value *,
+                            const Instruction &i) {
+  return !p.symbols[i.d]->getValue()->isList();
+}
+inline void execLIST_APPEND(State &, const Program &p, Value *r,
+                            const Instruction &i) {
+  p.symbols[i.d]->getValue()->listAppend(&r[i.a]);
+}
+inline bool execIF_NOT_STRING(State &, const Program &p, Value *,
+                              const Instruction &i) {
+  auto symbol = p.symbols[i.d];
+  return symbol->isDynamic() || !symbol->getValue()->isString();
+}
+inline void execAPPEND_STRING(State &, const Program &p, Value *r,
+                              const Instruction &i) {
+  auto value = p.symbols[i.d]->getValue();
+  for (unsigned k = 0; k < i.c; k++) {
+    value->appendString(r[p.operands[i.b + k]].asString());
+  }
+}
+inline void execPRINT_OPEN(State &s, const Program &, Value *r,
+                           const Instruction &i) {
+  s.printBuffer = s.outputBuffer.get();
+  if (i.a != NONE) {
+    auto &v = r[i.a];
+    if (!v.isString()) {
+      throw Exception("invalid file name" + v.asString());
+    }
+    s.printBuffer = LineBuffer::findOutputBuffer(v.asString().str()).get();
+  }
+}
+inline void execPRINT(State &s, const Program &, Value *r,
+                      const Instruction &i) {
+  s.print(&r[i.a], *s.printBuffer);
+}
+inline void execPRINT_ELT(State &s, const Program &, Value *r,
+                          const Instruction &i) {
+  s.printListElt(&r[i.a], r[i.b].asString(), *s.printBuffer, i.c);
+}
+inline void execPRINT_SEP(State &s, const Program &, Value *r,
+                          const Instruction &i) {
+  s.printBuffer->appendString(r[i.a].asString());
+}
+inline void execPRINT_END(State &s, const Program &, Value *,
+                          const Instruction &) {
+  s.printBuffer->appendString("\n", 1);
+}
+inline void execCOPY(State &s, const Program &, Value *,
+                     const Instruction &) {
+  s.outputBuffer->appendLine(s.getCurrentLine());
+}
+inline void execREPLACE_LINE(State &s, const Program &, Value *r,
+                             const Instruction &i) {
+  auto re = r[i.a].getRegEx();
+  auto &target = r[i.b].asString();
+  s.currentLine_ = s.getRegEx()->replace(re, target, s.getCurrentLine());
+}
+inline void execUSE_COLUMNS(State &s, const Program &, Value *,
+                            const Instruction &) {
+  s.matchColumns = true;
+  s.columns.clear();
+}
+inline void execCOLUMNS(State &s, const Program &p, Value *r,
+                        const Instruction &i) {
+  s.getColumns(r[i.d].asString(), p.operands.data() + i.b, i.c, r,
+               &s.columns);
+}
+inline void execSPLIT_LINE(State &s, const Program &, Value *r,
+                           const Instruction &i) {
+  auto sep = r[i.a].getRegEx();
+  auto &target = r[i.b].asString();
+  s.matchColumns = true;
+  s.columns.clear();
+  s.getRegEx()->split(sep, target, &s.columns);
+}
+inline void execERROR(State &, const Program &, Value *r,
+                      const Instruction &i) {
+  throw Exception(r[i.a].asString().str());
+}
+inline void execREQUIRE_COLUMNS(State &s, const Program &, Value *,
+                                const Instruction &i) {
+  if (!s.matchColumns || s.columns.size() < i.a) {
+    throw Exception("failed required column count");
+  }
+}
+inline void execFAIL_REQUIRED(State &s, const Program &, Value *r,
+                              const Instruction &i) {
+  throw Exception(s.requiredMessage(i.a == NONE ? nullptr : &r[i.a],
+                                    i.b == NONE ? nullptr : &r[i.b], i.c));
+}
+inline void execINPUT(State &s, const Program &, Value *r,
+                      const Instruction &i) {
+  s.input(&r[i.a], i.b);
+}
+inline void execOUTPUT(State &s, const Program &, Value *r,
+                       const Instruction &i) {
+  s.outputBuffer = LineBuffer::findOutputBuffer(r[i.a].asString().str());
+}
+inline void execCLOSE(State &s, const Program &, Value *r,
+                      const Instruction &i) {
+  s.close(i.a == NONE ? nullptr : &r[i.a], Close::Mode(i.b));
+}
+inline void execLOOP_INIT(State &s, const Program &, Value *,
+                          const Instruction &i) {
+  s.loopCounts[i.a] = i.b;
+  s.loopLast[i.a] = false;
+}
+inline bool execLOOP_EOF(State &s, const Program &, Value *,
+                         const Instruction &i) {
+  if (s.getInputEof()) {
+    return true;
+  }
+  s.getCurrentLine();
+  return false;
+}
+// returns the branch target, or NONE to continue with the predicate
+inline unsigned execLOOP_COUNT(State &s, const Program &, Value *,
+                               const Instruction &i) {
+  auto &count = s.loopCounts[i.a];
+  if (count == 0) {
+    return i.b;
+  }
+  if (--count == 0) {
+    s.loopLast[i.a] = true;
+    return i.c;
+  }
+  return NONE;
+}
+inline void execLOOP_LAST_IF(State &s, const Program &, Value *r,
+                             const Instruction &i) {
+  if (r[i.b].asLogical()) {
+    s.loopLast[i.a] = true;
+  }
+}
+inline void execLOOP_NEXT(State &s, const Program &, Value *,
+                          const Instruction &) {
+  s.nextLine();
+}
+// true when the loop is done with its last line
+inline bool execLOOP_NEXT_LAST(State &s, const Program &, Value *,
+                               const Instruction &i) {
+  if (s.loopLast[i.a]) {
+    s.loopLast[i.a] = false;
+    s.needLine = true;
+    return true;
+  }
+  s.nextLine();
+  return false;
+}
+inline bool execKERNEL(State &s, const Program &p, Value *r,
+                       const Instruction &i) {
+  return s.runKernel(p.kernels[i.a], r);
+}
+}
+
+#endif /* Runtime_h */
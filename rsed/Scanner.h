@@ -4,15 +4,22 @@
 #endif
 #include <iostream>
 
+union ParseResult;
+
 class Scanner : public yyFlexLexer {
 public:
   Scanner() {}
+  // where yylex stores the value of a token
+  ParseResult *yylval = nullptr;
   int init(const char *source);
+  void init(std::istream *source) { yyin = source; }
   int yylex();
   bool sawError = false;
+  // where syntax errors are reported
+  std::ostream *errors = &std::cerr;
   std::ostream &error() {
     sawError = true;
-    return std::cerr << lineno() << "; ";
+    return *errors << lineno() << "; ";
   }
   
   std::string * multilineString(std::string * unputText);
@@ -5,8 +5,12 @@
 //  Created by David Callahan on 6/29/15.
 //  Copyright (c) 2015 David Callahan. All rights reserved.
 //
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
+#include <unordered_set>
 #include "StringRef.h"
+#include "Context.h"
 
 namespace {
 std::string asCLiteral(const std::string &s) {
@@ -62,6 +66,117 @@ std::string asCLiteral(const std::string &s) {
 }
 }
 
+char *StringRef::create(size_t length) {
+  len = length;
+  inlined = (length <= INLINE_LENGTH);
+  interned = false;
+  char *target = local;
+  if (!inlined) {
+    shared.rep = (Rep *)std::malloc(offsetof(Rep, text) + length + 1);
+    shared.rep->refs = 1;
+    shared.rep->capacity = length;
+    shared.offset = 0;
+    target = shared.rep->text;
+  }
+  target[length] = 0;
+  return target;
+}
+
+void StringRef::init(const char *text, size_t length) {
+  std::memcpy(create(length), text, length);
+}
+
+char *StringRef::allocate(size_t length, unsigned flags) {
+  release();
+  this->flags = flags;
+  return create(length);
+}
+
+StringRef StringRef::slice(size_t start, size_t length) const {
+  StringRef result;
+  if (length <= INLINE_LENGTH) {
+    std::memcpy(result.local, data() + start, length);
+    result.local[length] = 0;
+  } else if (shared.rep->capacity > SHARED_BLOCK_LIMIT &&
+             length < shared.rep->capacity / 8) {
+    // a small piece of a large block, which it would keep allocated
+    result.init(data() + start, length);
+  } else {
+    result.inlined = false;
+    result.shared.rep = shared.rep;
+    result.shared.offset = shared.offset + start;
+    shared.rep->refs += 1;
+  }
+  result.len = length;
+  return result;
+}
+
+void StringRef::append(const char *text, size_t length, unsigned flags) {
+  this->flags |= flags;
+  size_t newLength = len + length;
+  bool fits = (inlined ? newLength <= INLINE_LENGTH
+                       : shared.rep->refs == 1 &&
+                             shared.offset + newLength <= shared.rep->capacity);
+  if (fits) {
+    auto target = const_cast<char *>(data());
+    std::memcpy(target + len, text, length);
+    target[newLength] = 0;
+    len = newLength;
+    return;
+  }
+  auto capacity = std::max(newLength, 2 * size_t(len));
+  auto rep = (Rep *)std::malloc(offsetof(Rep, text) + capacity + 1);
+  rep->refs = 1;
+  rep->capacity = capacity;
+  std::memcpy(rep->text, data(), len);
+  std::memcpy(rep->text + len, text, length);
+  rep->text[newLength] = 0;
+  release();
+  inlined = false;
+  interned = false;
+  shared.rep = rep;
+  shared.offset = 0;
+  len = newLength;
+}
+
+size_t StringRef::hash() const {
+  size_t h = 2166136261u;
+  for (auto c : *this) {
+    h = (h ^ (unsigned char)c) * 16777619u;
+  }
+  return h;
+}
+
+StringRef StringRef::intern() const {
+  auto table = &Context::current()->interned;
+  auto i = table->find(*this);
+  if (i == table->end()) {
+    // always out of line so copies share (and compare by) storage
+    StringRef unique;
+    unique.len = len;
+    unique.inlined = false;
+    unique.shared.rep = (Rep *)std::malloc(offsetof(Rep, text) + len + 1);
+    unique.shared.rep->refs = 1;
+    unique.shared.rep->capacity = len;
+    unique.shared.offset = 0;
+    std::memcpy(unique.shared.rep->text, data(), len);
+    unique.shared.rep->text[len] = 0;
+    unique.interned = true;
+    i = table->insert(std::move(unique)).first;
+  }
+  StringRef result(*i);
+  result.flags = flags;
+  return result;
+}
+
+int StringRef::compare(const StringRef &r) const {
+  auto n = std::min(len, r.len);
+  if (auto c = std::memcmp(data(), r.data(), n)) {
+    return c;
+  }
+  return (len < r.len ? -1 : len > r.len);
+}
+
 StringRef::StringRef(std::string *text) : flags(0) {
   auto len = text->length();
   auto delim = text->at(0);
@@ -85,14 +200,17 @@ StringRef::StringRef(std::string *text) : flags(0) {
       break;
     }
   }
-  this->text = text->substr(1, len - 2);
+  auto body = text->substr(1, len - 2);
   if (!(flags & RAW_STRING)) {
-    this->text = asCLiteral(this->text);
+    body = asCLiteral(body);
   }
+  init(body.data(), body.length());
   delete text;
 }
 std::ostream &operator<<(std::ostream &OS, const StringRef &s) {
-  OS << '\"' << s.getText() << '"';
+  OS << '\"';
+  OS.write(s.data(), s.length());
+  OS << '"';
   if (s.getFlags()) {
     if (s.getFlags() & s.RAW_STRING) {
       OS << 'r';
@@ -8,14 +8,20 @@
 
 #ifndef rsed_StringRef_h
 #define rsed_StringRef_h
-#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <iosfwd>
 #include <string>
-#include <sstream>
 
+// An immutable string plus flags. Short strings are stored inline; longer
+// strings live in a single heap block shared by all copies and released
+// by a (non-atomic) reference count. A heap string may be a slice of a
+// larger block (offset + length), so substrings, columns and split words
+// share the parent text instead of copying it. A slice that is much
+// smaller than a large block is copied instead, so a piece kept in a
+// variable, list or map does not keep a long line or file allocated.
+// Slices are not null terminated.
 class StringRef {
-  std::string text;
-  unsigned flags;
-
 public:
   enum {
     RAW_STRING = 1,
@@ -24,36 +30,152 @@ public:
     ESCAPE_SPECIALS = 8,
   };
 
-  StringRef() : flags(0) {}
-  StringRef(std::string &&text, unsigned flags=0) : text(text), flags(flags) {}
-  unsigned getFlags() const { return flags; }
-  const std::string &getText() const { return text; }
+private:
+  struct Rep {
+    unsigned refs;
+    unsigned capacity;
+    char text[1];
+  };
+  enum { INLINE_LENGTH = 15 };
+  // blocks up to this size are always shared by their slices; a slice of
+  // a larger one shares it only if it is at least an eighth of the block
+  enum { SHARED_BLOCK_LIMIT = 1024 };
+  struct Shared {
+    Rep *rep;
+    unsigned offset;
+  };
+  union {
+    char local[INLINE_LENGTH + 1];
+    Shared shared;
+  };
+  unsigned len;
+  unsigned char flags;
+  bool inlined;
+  // the storage is the unique copy held by an intern table, so two
+  // strings interned in one Context are equal exactly when they share
+  // storage; strings from different Contexts may still meet (a batch
+  // shares its files between them) and are compared by their text
+  bool interned;
+
+  char *create(size_t length);
+  void init(const char *text, size_t length);
+  void copyFrom(const StringRef &s) {
+    std::memcpy(local, s.local, sizeof(local));
+    len = s.len;
+    flags = s.flags;
+    inlined = s.inlined;
+    interned = s.interned;
+    if (!inlined) {
+      shared.rep->refs += 1;
+    }
+  }
+  void release() {
+    if (!inlined && --shared.rep->refs == 0) {
+      std::free(shared.rep);
+    }
+  }
+
+public:
+  StringRef() : len(0), flags(0), inlined(true), interned(false) {
+    local[0] = 0;
+  }
+  StringRef(const char *text, unsigned flags = 0) : flags(flags) {
+    init(text, std::strlen(text));
+  }
+  StringRef(const char *text, size_t length, unsigned flags) : flags(flags) {
+    init(text, length);
+  }
+  StringRef(const std::string &text, unsigned flags = 0) : flags(flags) {
+    init(text.data(), text.length());
+  }
   StringRef(std::string *asScanned);
+  StringRef(const StringRef &s) { copyFrom(s); }
+  StringRef(StringRef &&s) {
+    copyFrom(s);
+    s.clear();
+  }
+  StringRef &operator=(const StringRef &s) {
+    if (this != &s) {
+      release();
+      copyFrom(s);
+    }
+    return *this;
+  }
+  StringRef &operator=(StringRef &&s) {
+    if (this != &s) {
+      release();
+      copyFrom(s);
+      s.clear();
+    }
+    return *this;
+  }
+  ~StringRef() { release(); }
+
+  unsigned getFlags() const { return flags; }
+  const char *data() const {
+    return (inlined ? local : shared.rep->text + shared.offset);
+  }
+  size_t length() const { return len; }
+  bool empty() const { return len == 0; }
+  char operator[](size_t i) const { return data()[i]; }
+  const char *begin() const { return data(); }
+  const char *end() const { return data() + len; }
+  std::string str() const { return std::string(data(), len); }
 
-  void append(const std::string &r) { text.append(r); }
-  void append(const StringRef &r) { append(r.getText()); }
-  void append(int n) {
-    std::stringstream ss;
-    ss << n;
-    std::string temp;
-    ss >> temp;
-    append(temp);
+  // characters [start, start+length) of this string, which must be in
+  // range; shares this string's storage unless the slice fits inline or
+  // is a small part of a large block
+  StringRef slice(size_t start, size_t length) const;
+
+  // replace this string with 'length' uninitialized characters and return
+  // them so the caller can fill them in before the string is shared
+  char *allocate(size_t length, unsigned flags);
+
+  // add text (and flags) to the end of this string, in place when the
+  // storage is not shared and has room, otherwise growing geometrically
+  void append(const char *text, size_t length, unsigned flags);
+
+  int compare(const StringRef &r) const;
+  bool operator==(const StringRef &r) const {
+    if (interned && r.interned && shared.rep == r.shared.rep) {
+      return true;
+    }
+    return len == r.len && std::memcmp(data(), r.data(), len) == 0;
+  }
+  bool operator!=(const StringRef &r) const { return !(*this == r); }
+  bool operator<(const StringRef &r) const { return compare(r) < 0; }
+  bool operator==(const char *text) const {
+    return len == std::strlen(text) && std::memcmp(data(), text, len) == 0;
   }
 
   bool isRaw() const { return flags & RAW_STRING; }
   void setIsRaw() { flags |= RAW_STRING; }
   void setIsGlobal() { flags |= GLOBAL; }
   bool escapeSpecials() const { return flags & ESCAPE_SPECIALS; }
-  void clear() { flags = 0, text.clear(); }
+
+  // FNV-1a hash of the characters
+  size_t hash() const;
+  struct Hash {
+    size_t operator()(const StringRef &s) const { return s.hash(); }
+  };
+
+  // the single shared copy of this text (with this string's flags) in
+  // the current Context's table, which holds it until the Context ends
+  StringRef intern() const;
+  bool isInterned() const { return interned; }
+
+  void clear() {
+    release();
+    inlined = true;
+    interned = false;
+    local[0] = 0;
+    len = 0;
+    flags = 0;
+  }
 };
 std::ostream &operator<<(std::ostream &, const StringRef &);
-inline std::string operator+(std::string left, StringRef right) {
-  return left + right.getText();
-}
-
-typedef std::shared_ptr<const StringRef> StringPtr;
-inline StringPtr asShared(const StringRef & s) {
-  return StringPtr(&s, [](const StringRef *){});
+inline std::string operator+(std::string left, const StringRef &right) {
+  return left.append(right.data(), right.length());
 }
 
 #endif
@@ -12,33 +12,35 @@
 #include <sstream>
 #include <string>
 #include <fstream>
-#include "rsed.h" 
+#include "Context.h"
 
 using std::string;
-using namespace RSED;
 
-namespace {
-std::unordered_map<string, Symbol *> stringMap;
-unsigned nextTemp = 0;
+Symbol *Symbol::findSymbol(const string &name) {
+  return findSymbol(StringRef(name));
 }
 
-Symbol *Symbol::findSymbol(const string &name) {
-  auto p = stringMap.insert(std::make_pair(name, nullptr));
-  if (p.second) {
-    auto s = new SimpleSymbol(std::move(name));
-    if (auto e = getenv(name.c_str())) {
-      s->setValue(e);
-      if (env_save.is_open()) {
-        env_save << "export "<< name << "=\"" << e << "\"\n";
-      }
+Symbol *Symbol::findSymbol(const StringRef &key) {
+  auto context = Context::current();
+  auto &stringMap = context->symbols;
+  auto i = stringMap.find(key);
+  if (i != stringMap.end()) {
+    return i->second;
+  }
+  auto name = key.str();
+  auto s = new SimpleSymbol(name);
+  if (auto e = getenv(name.c_str())) {
+    s->setValue(e);
+    if (context->envSave.is_open()) {
+      context->envSave << "export "<< name << "=\"" << e << "\"\n";
     }
-    p.first->second = s;
   }
-  return p.first->second;
+  stringMap.emplace(key.intern(), s);
+  return s;
 }
 
 void Symbol::defineSymbol(Symbol *sym) {
-  auto &s = stringMap[sym->name];
+  auto &s = Context::current()->symbols[StringRef(sym->name).intern()];
   if (s) {
     delete s;
   }
@@ -46,11 +48,13 @@ void Symbol::defineSymbol(Symbol *sym) {
 }
 
 Symbol *Symbol::newTempSymbol() {
+  auto context = Context::current();
   for (;;) {
     std::stringstream buffer;
-    buffer << "temp" << nextTemp++;
+    buffer << "temp" << context->nextTemp++;
     string name = buffer.str();
-    auto p = stringMap.insert(std::make_pair(name, nullptr));
+    auto p = context->symbols.insert(
+        std::make_pair(StringRef(name).intern(), nullptr));
     if (p.second) {
       auto s = new SimpleSymbol(std::move(name));
       p.first->second = s;
@@ -27,6 +27,10 @@ public:
   }
   virtual Value * getValue() { return this; }
   static Symbol *findSymbol(const std::string &name);
+  static Symbol *findSymbol(const StringRef &name);
+  static Symbol *findSymbol(const char *name) {
+    return findSymbol(StringRef(name));
+  }
   static Symbol *newTempSymbol();
   static void defineSymbol(Symbol *sym);
 };
@@ -7,16 +7,90 @@
 //
 
 #include "Value.h"
+#include <algorithm>
 #include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
 #include <assert.h>
 #include "Exception.h"
 using std::string;
 using std::stringstream;
 
+namespace {
+// Parse a number the way operator>> does: skip leading white space, take
+// the longest prefix of the form [+-]digits[.digits][e[+-]digits] and
+// require that all of it converts. Trailing text is ignored. Returns
+// false when there is no number.
+bool parseNumber(const StringRef &s, double *result) {
+  auto p = s.begin(), end = s.end();
+  while (p != end && std::isspace((unsigned char)*p)) {
+    p++;
+  }
+  auto start = p;
+  auto digits = [&p, end]() {
+    auto first = p;
+    while (p != end && std::isdigit((unsigned char)*p)) {
+      p++;
+    }
+    return p != first;
+  };
+  if (p != end && (*p == '+' || *p == '-')) {
+    p++;
+  }
+  bool mantissa = digits();
+  if (p != end && *p == '.') {
+    p++;
+    mantissa |= digits();
+  }
+  if (!mantissa) {
+    return false;
+  }
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p != end && (*p == '+' || *p == '-')) {
+      p++;
+    }
+    digits();
+  }
+
+  // strtod needs a terminated copy; numbers are almost always short
+  char local[Value::NUMBER_BUFFER_SIZE];
+  std::string big;
+  size_t length = p - start;
+  char *buffer = local;
+  if (length >= sizeof(local)) {
+    big.assign(start, length);
+    buffer = &big[0];
+  } else {
+    std::memcpy(local, start, length);
+    local[length] = 0;
+  }
+  char *last;
+  *result = std::strtod(buffer, &last);
+  if (size_t(last - buffer) != length) {
+    return false;
+  }
+  return *result != HUGE_VAL && *result != -HUGE_VAL;
+}
+}
+
 void Value::set(const Value *value) {
+  if (value == this) {
+    return;
+  }
+  // share first, 'value' may be an element of this list
+  if (value->kind == List) {
+    value->list->refs += 1;
+  } else if (value->kind == Map) {
+    value->map->refs += 1;
+  }
+  releaseList();
   kind = value->kind;
-  scache.clear();
-  cur = nullptr;
+  text = value->text;
+  hasNumber = value->hasNumber;
   switch (kind) {
   case Logical:
     logical = value->logical;
@@ -28,18 +102,70 @@ void Value::set(const Value *value) {
     regEx = value->regEx;
     break;
   case String:
-    if (auto s = value->constString()) {
-      cur = std::move(s);
-    } else {
-      cur = nullptr;
-      scache = value->scache;
-    }
+    number = value->number;
     break;
   case List:
-    list.clear();
-    for (auto &v : value->list) {
-      list.push_back(v);
+    list = value->list;
+    break;
+  case Map:
+    map = value->map;
+    break;
+  }
+}
+
+Value::ListType &Value::mutableList() {
+  assert(kind == List);
+  text.clear();
+  if (list->refs > 1) {
+    list->refs -= 1;
+    list = new ListRep(list->elements);
+  }
+  return list->elements;
+}
+
+void Value::listAppend(Value *v) {
+  if (v->kind != List) {
+    mutableList().emplace_back(*v);
+  } else if (list->elements.empty() && v != this) {
+    // appending to an empty list: share the other list
+    v->list->refs += 1;
+    releaseList();
+    list = v->list;
+    text.clear();
+  } else {
+    // copy the handle, v may be this list
+    Value other(*v);
+    auto &elements = mutableList();
+    for (auto &lv : other.getList()) {
+      elements.emplace_back(lv);
     }
+  }
+}
+
+void Value::moveFrom(Value &value) {
+  kind = value.kind;
+  text = std::move(value.text);
+  hasNumber = value.hasNumber;
+  switch (kind) {
+  case Logical:
+    logical = value.logical;
+    break;
+  case Number:
+  case String:
+    number = value.number;
+    break;
+  case RegEx:
+    regEx = value.regEx;
+    break;
+  case List:
+    list = value.list;
+    value.kind = Logical;
+    value.logical = false;
+    break;
+  case Map:
+    map = value.map;
+    value.kind = Logical;
+    value.logical = false;
     break;
   }
 }
@@ -50,12 +176,12 @@ bool Value::asLogical() const {
     return logical;
   case Number:
     return number != 0 && number == number;
-  case String: {
-    auto s = getString();
-    return !(s.getText().empty() || s.getText() == "false");
-  }
+  case String:
+    return !(text.empty() || text == "false");
   case List:
-    return !list.empty();
+    return !list->elements.empty();
+  case Map:
+    return !map->empty();
   case RegEx:
     assert(0 && "can not convert regex to logical");
     throw;
@@ -69,17 +195,22 @@ double Value::asNumber() {
   case Number:
     return number;
   case List:
-    asString();
-  // fallthorugh
   case String: {
-    stringstream ss(getString().getText());
+    if (hasNumber) {
+      return number;
+    }
     double result;
-    ss >> result;
-    if (ss.fail()) {
-      throw Exception("unable to convert to number: " + getString().getText());
+    if (!parseNumber(asString(), &result)) {
+      throw Exception("unable to convert to number: " + text);
+    }
+    if (kind == String) {
+      number = result;
+      hasNumber = true;
     }
     return result;
   }
+  case Map:
+    throw Exception("unable to convert a map to a number");
   case RegEx:
     assert(0 && "can not convert regex to number");
     throw;
@@ -90,60 +221,61 @@ static const StringRef trueString("true", 0);
 static const StringRef falseString("false", 0);
 
 const StringRef &Value::asString() {
-
-  if (cur) {
-    return *cur;
-  }
-  if (!scache.getText().empty()) {
-    return scache;
+  if (kind == String || !text.empty()) {
+    return text;
   }
 
   switch (kind) {
   case Logical: {
-    set(asShared(logical ? trueString : falseString));
+    text = (logical ? trueString : falseString);
     break;
   }
   case Number: {
-    stringstream ss;
-    if (number != number) {
-      ss << "NaN";
-    } else {
-      ss << number;
-    }
-    set(ss.str());
+    char buffer[NUMBER_BUFFER_SIZE];
+    text = StringRef(buffer, formatNumber(number, buffer), 0);
     break;
   }
   case List: {
-    stringstream ss;
-    for (auto &v : list) {
-      ss << v.asString().getText();
+    // cache the concatenated elements, the value remains a list
+    size_t length = 0;
+    for (auto &v : list->elements) {
+      length += v.asString().length();
+    }
+    auto target = text.allocate(length, 0); // TODO propagate flags?
+    for (auto &v : list->elements) {
+      auto &s = v.getString();
+      std::memcpy(target, s.data(), s.length());
+      target += s.length();
     }
-    set(ss.str()); // TODO propagate flags?
     break;
   }
   case String:
-    return scache;
+    break;
+  case Map:
+    throw Exception("unable to convert a map to a string");
   case RegEx:
     assert(0 && "can not convert regex to number");
   }
-  return getString();
+  return text;
 }
 
-StringPtr Value::asStringPtr() {
-  if (!cur) {
-    cur = std::make_shared<const StringRef>(asString());
+unsigned Value::formatNumber(double number, char *buffer) {
+  if (number != number) {
+    std::memcpy(buffer, "NaN", 4);
+    return 3;
   }
-  return cur;
+  // %g matches the default formatting of operator<<
+  return std::snprintf(buffer, NUMBER_BUFFER_SIZE, "%g", number);
 }
 
 std::ostream &operator<<(std::ostream &OS, const Value &value) {
   switch (value.kind) {
   case Value::RegEx:
-    OS << "regex[" << value.regEx << "]";
+    OS << "regex[" << value.getRegEx() << "]";
     break;
   case Value::List: {
     char sep = '[';
-    for (auto &v : value.list) {
+    for (auto &v : value.getList()) {
       OS << sep << v;
       sep = ',';
     }
@@ -151,53 +283,61 @@ std::ostream &operator<<(std::ostream &OS, const Value &value) {
     break;
   }
   case Value::Logical:
-    OS << (value.logical ? "true" : "false");
+    OS << (value.getLogical() ? "true" : "false");
     break;
   case Value::Number:
-    OS << value.number;
+    OS << value.getNumber();
     break;
   case Value::String:
     OS << value.getString();
     break;
+  case Value::Map: {
+    char sep = '{';
+    for (auto &e : value.getMap().getEntries()) {
+      OS << sep << e.key << ": " << e.value;
+      sep = ',';
+    }
+    if (sep == '{') {
+      OS << sep;
+    }
+    OS << '}';
+    break;
+  }
   }
   return OS;
 }
 
 void Value::set(bool boole) {
+  releaseList();
   logical = boole;
   kind = Logical;
-  scache.clear();
-  cur = nullptr;
+  text.clear();
 }
 
 void Value::set(double n) {
+  releaseList();
   kind = Number;
   number = n;
-  scache.clear();
-  cur = nullptr;
+  text.clear();
 }
 
 void Value::set(StringRef s) {
+  releaseList();
   kind = String;
-  scache = std::move(s);
-  cur = nullptr;
-}
-void Value::set(StringPtr s) {
-  kind = String;
-  scache.clear();
-  cur = std::move(s);
+  text = std::move(s);
+  hasNumber = false;
 }
 
 void Value::setRegEx(unsigned int i) {
+  releaseList();
   kind = RegEx;
   regEx = i;
-  scache.clear();
-  cur = nullptr;
+  text.clear();
 }
 
-void Value::set(std::string s) { set(StringRef(std::move(s))); }
+void Value::set(std::string s) { set(StringRef(s)); }
 
-unsigned Value::getRegEx() {
+unsigned Value::getRegEx() const {
   assert(kind == RegEx);
   return regEx;
 }
@@ -221,7 +361,9 @@ int compare(Value *left, Value *right) {
   case Value::Number:
     return cmp(left->asNumber(), right->asNumber());
   case Value::String:
-    return cmp(left->asString().getText(), right->asString().getText());
+    return cmp(left->asString().compare(right->asString()), 0);
+  case Value::Map:
+    throw Exception("unable to compare maps");
   case Value::List:
   case Value::RegEx:
     assert(0 && "can not compare regex");
@@ -229,15 +371,104 @@ int compare(Value *left, Value *right) {
   }
 }
 
+bool equal(Value *left, Value *right) {
+  auto k = std::min(left->kind, right->kind);
+  if (k == Value::String || k == Value::List) {
+    // a pointer compare when both strings are interned
+    return left->asString() == right->asString();
+  }
+  return compare(left, right) == 0;
+}
+
 void Value::append(const Value &v) {
-  assert(kind == List);
-  list.emplace_back(v);
+  mutableList().emplace_back(v);
 }
 
-void Value::set(std::vector<std::string> *values) {
+void Value::set(std::vector<StringRef> *values) {
   clearList();
   for (auto &w : *values) {
     listAppend(std::move(w));
   }
   values->clear();
 }
+
+void Value::releaseMap() {
+  if (--map->refs == 0) {
+    delete map;
+  }
+}
+
+void Value::clearMap() {
+  text.clear();
+  hasNumber = false;
+  if (kind == Map && map->refs == 1) {
+    map->clear();
+  } else {
+    releaseList();
+    map = new ValueMap;
+    kind = Map;
+  }
+}
+
+const Value *Value::mapFind(const StringRef &key) const {
+  assert(kind == Map);
+  return map->find(key);
+}
+
+Value *Value::mapInsert(const StringRef &key) {
+  assert(kind == Map);
+  if (map->refs > 1) {
+    map->refs -= 1;
+    map = new ValueMap(*map);
+  }
+  return map->insert(key);
+}
+
+// the slot holding key, or the empty slot where it belongs
+unsigned *ValueMap::probe(const StringRef &key, size_t hash) {
+  auto mask = slots.size() - 1;
+  for (auto i = hash & mask;; i = (i + 1) & mask) {
+    auto &slot = slots[i];
+    if (slot == 0) {
+      return &slot;
+    }
+    auto &e = entries[slot - 1];
+    if (e.hash == hash && e.key == key) {
+      return &slot;
+    }
+  }
+}
+
+Value *ValueMap::find(const StringRef &key) {
+  if (entries.empty()) {
+    return nullptr;
+  }
+  auto slot = *probe(key, key.hash());
+  return (slot ? &entries[slot - 1].value : nullptr);
+}
+
+Value *ValueMap::insert(const StringRef &key) {
+  // keep the table at most half full
+  if (2 * (entries.size() + 1) > slots.size()) {
+    grow();
+  }
+  auto h = key.hash();
+  auto slot = probe(key, h);
+  if (*slot == 0) {
+    entries.push_back(Entry{key, Value(StringRef()), h});
+    *slot = entries.size();
+  }
+  return &entries[*slot - 1].value;
+}
+
+void ValueMap::grow() {
+  slots.assign(std::max<size_t>(8, 2 * slots.size()), 0);
+  auto mask = slots.size() - 1;
+  for (unsigned i = 0; i < entries.size(); i++) {
+    auto j = entries[i].hash & mask;
+    while (slots[j]) {
+      j = (j + 1) & mask;
+    }
+    slots[j] = i + 1;
+  }
+}
@@ -15,79 +15,177 @@
 
 // typedef std::unique_ptr<class Value> ValueP;
 typedef class Value *ValueP;
+class ValueMap;
 
 class Value {
-  StringRef scache;
 public:
-  enum Kind {
+  enum Kind : unsigned char {
     String,
     Logical,
     Number,
     RegEx,
     List,
+    Map,
   };
+  typedef std::vector<Value> ListType;
+
+private:
+  // list elements shared by copies of a list value; a list is copied
+  // only when a value that shares it is modified
+  struct ListRep {
+    unsigned refs;
+    ListType elements;
+    ListRep() : refs(1) {}
+    ListRep(const ListType &elements) : refs(1), elements(elements) {}
+  };
+
+  // the value of a String, or the cached string form of other kinds
+  StringRef text;
+  // the payload for the current kind; a String keeps its parsed numeric
+  // form in 'number' when hasNumber is set
+  union {
+    bool logical;
+    double number;
+    unsigned regEx;
+    ListRep *list;
+    ValueMap *map;
+  };
+
+public:
   Kind kind;
-  StringPtr cur = nullptr;
-  bool logical = false;
-  double number = 0.0;
-  unsigned regEx;
-  std::vector<Value> list;
-  Value(StringRef string) : scache{string}, kind(String)  {}
-  Value(StringPtr string) : kind(String), cur(string) {}
-  Value(bool logical = false) : kind(Logical), logical(logical) {}
-  Value(double number) : kind(Number), number(number) {}
-  Value(const Value &value) { set(&value); }
-  
-  const StringRef & getString() const {
-    return (cur ? *cur : scache);
+
+private:
+  bool hasNumber = false;
+
+  void releaseList() {
+    if (kind == List && --list->refs == 0) {
+      delete list;
+    } else if (kind == Map) {
+      releaseMap();
+    }
+  }
+  void releaseMap();
+  void moveFrom(Value &value);
+  // the elements of this list, unshared so they can be modified
+  ListType &mutableList();
+
+public:
+  Value(StringRef string) : text(std::move(string)), kind(String) {}
+  Value(bool logical = false) : logical(logical), kind(Logical) {}
+  Value(double number) : number(number), kind(Number) {}
+  Value(const Value &value) : kind(Logical) { set(&value); }
+  Value(Value &&value) noexcept : kind(Logical) { moveFrom(value); }
+  Value &operator=(const Value &value) {
+    set(&value);
+    return *this;
   }
+  Value &operator=(Value &&value) noexcept {
+    if (this != &value) {
+      releaseList();
+      moveFrom(value);
+    }
+    return *this;
+  }
+  ~Value() { releaseList(); }
+
+  const StringRef &getString() const { return text; }
   bool isString() const { return kind == String; }
   bool isList() const { return kind == List; }
-  unsigned listLength() const { return list.size(); }
+  bool isMap() const { return kind == Map; }
+  unsigned listLength() const { return list->elements.size(); }
+  const ListType &getList() const { return list->elements; }
+  // elements may be shared with other values; use them only for
+  // conversions (asString, asNumber) whose caching is not visible
+  ListType &getList() { return list->elements; }
+  bool getLogical() const { return logical; }
+  double getNumber() const { return number; }
   const StringRef &asString();
   bool asLogical() const;
   double asNumber();
-  unsigned getRegEx();
-  StringPtr asStringPtr();
-  StringPtr constString() const { return cur; }
+  unsigned getRegEx() const;
+
+  // format a number as asString() would but into a caller supplied
+  // buffer of NUMBER_BUFFER_SIZE characters, returns the length
+  enum { NUMBER_BUFFER_SIZE = 32 };
+  static unsigned formatNumber(double number, char *buffer);
 
   void set(bool);
   void set(double);
   void set(StringRef);
-  void set(StringPtr);
   void set(std::string);
   void set(const Value *value);
-  void setString(Value * v) {
-    if (auto s = v->constString()) {
-      set(s);
-    }
-    else {
-      set(v->asString());
-    }
-  }
+  void set(Value &&value) { *this = std::move(value); }
+  void setString(Value *v) { set(v->asString()); }
   void setRegEx(unsigned i);
   void append(const Value &);
   void clearList() {
-    scache.clear();
-    cur = nullptr;
-    list.clear();
-    kind = List;
-  }
-  void listAppend(Value *v) {
-    if (v->kind == List) {
-      for (auto &lv : v->list) {
-        list.emplace_back(lv);
-      }
+    text.clear();
+    hasNumber = false;
+    if (kind == List && list->refs == 1) {
+      list->elements.clear();
     } else {
-      list.emplace_back(*v);
+      releaseList();
+      list = new ListRep;
+      kind = List;
     }
   }
-  void set(std::vector<std::string> * values);
-  void listAppend(std::string text) {
-    list.emplace_back(StringRef(std::move(text),0));
+  void listAppend(Value *v);
+  void set(std::vector<StringRef> *values);
+
+  // make this an empty map
+  void clearMap();
+  const ValueMap &getMap() const { return *map; }
+  // the value stored under key or null
+  const Value *mapFind(const StringRef &key) const;
+  // the value stored under key, adding an empty string if needed; the
+  // pointer is valid until the map is next modified
+  Value *mapInsert(const StringRef &key);
+  // add to the end of a String value, in place when possible
+  void appendString(const StringRef &s) {
+    hasNumber = false;
+    text.append(s.data(), s.length(), s.getFlags());
+  }
+  void listAppend(StringRef string) {
+    mutableList().emplace_back(std::move(string));
   }
 };
+
+// A string keyed hash table. Entries are kept in insertion order and
+// found through an open addressing (linear probing) table of entry
+// indices, so iteration is deterministic. Shared by copies of a map
+// value and copied when a shared map is modified.
+class ValueMap {
+public:
+  struct Entry {
+    StringRef key;
+    Value value;
+    size_t hash;
+  };
+  unsigned refs = 1;
+
+  ValueMap() {}
+  ValueMap(const ValueMap &m) : entries(m.entries), slots(m.slots) {}
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+  const std::vector<Entry> &getEntries() const { return entries; }
+  Value *find(const StringRef &key);
+  Value *insert(const StringRef &key);
+  void clear() {
+    entries.clear();
+    slots.clear();
+  }
+
+private:
+  std::vector<Entry> entries;
+  // index + 1 of an entry, or 0 for an empty slot; a power of two in size
+  std::vector<unsigned> slots;
+
+  unsigned *probe(const StringRef &key, size_t hash);
+  void grow();
+};
+
 std::ostream &operator<<(std::ostream &OS, const Value &value);
 int compare(Value *left, Value *right);
+bool equal(Value *left, Value *right);
 
 #endif /* Value_hpp */
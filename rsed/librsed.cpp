@@ -0,0 +1,148 @@
+//
+//  librsed.cpp
+//  rsed
+//
+
+#include "librsed.h"
+#include <sstream>
+#include <unordered_map>
+#include "AST.h"
+#include "Bytecode.h"
+#include "Context.h"
+#include "Exception.h"
+#include "Interpreter.h"
+#include "LineBuffer.h"
+#include "Optimize.h"
+#include "Parser.h"
+#include "Symbol.h"
+
+namespace rsed {
+
+struct Script::Impl {
+  Interpreter interpreter;
+  std::unique_ptr<Bytecode::Program> program;
+  // the values of the variables when the script was compiled
+  std::unordered_map<Symbol *, Value> initial;
+  unsigned linesBefore = 0;
+  std::string inputName = "<input>";
+
+  void saveSymbols();
+  void resetSymbols();
+};
+
+void Script::Impl::saveSymbols() {
+  for (auto &s : interpreter.getContext().symbols) {
+    if (!s.second->isDynamic()) {
+      initial.emplace(s.second, *s.second->getValue());
+    }
+  }
+}
+
+// restore the variables of the script and forget those created by
+// name during an earlier run
+void Script::Impl::resetSymbols() {
+  auto &symbols = interpreter.getContext().symbols;
+  for (auto i = symbols.begin(); i != symbols.end();) {
+    auto s = i->second;
+    if (s->isDynamic()) {
+      ++i;
+      continue;
+    }
+    auto v = initial.find(s);
+    if (v == initial.end()) {
+      delete s;
+      i = symbols.erase(i);
+      continue;
+    }
+    s->set(&v->second);
+    ++i;
+  }
+}
+
+Script::Script() : impl(new Impl) {}
+Script::~Script() {}
+
+std::unique_ptr<Script> Script::compile(const std::string &text,
+                                        std::string *errors,
+                                        const std::vector<std::string> &args) {
+  std::unique_ptr<Script> script(new Script);
+  auto &impl = *script->impl;
+  Context::Scope scope(impl.interpreter.getContext());
+
+  std::vector<char *> argv{const_cast<char *>("rsed")};
+  for (auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  std::ostringstream messages;
+  try {
+    impl.interpreter.initialize(argv.size(), argv.data(), nullptr, nullptr);
+    std::istringstream in(text);
+    Parser parser;
+    if (auto ast = parser.parse(in, messages)) {
+      impl.program.reset(Bytecode::compile(Optimize::optimize(ast)));
+    }
+  } catch (Exception &e) {
+    messages << e;
+  }
+  if (!impl.program) {
+    if (errors) {
+      *errors = messages.str();
+    }
+    return nullptr;
+  }
+  impl.saveSymbols();
+  return script;
+}
+
+bool Script::run(ReadLine read, WriteText write, std::string *error) {
+  Context::Scope scope(impl->interpreter.getContext());
+  impl->resetSymbols();
+  auto in = LineBuffer::makeCallbackInBuffer(std::move(read), impl->inputName);
+  in->setLinesBefore(impl->linesBefore);
+  impl->interpreter.setIO(
+      std::move(in),
+      LineBuffer::makeCallbackOutBuffer(std::move(write), "<output>"));
+  try {
+    impl->interpreter.run(*impl->program);
+    LineBuffer::closeAll();
+  } catch (Exception &e) {
+    if (error) {
+      std::ostringstream message;
+      message << e;
+      *error = message.str();
+    }
+    // the temporary files and commands of this run end with it
+    try {
+      LineBuffer::closeAll();
+    } catch (Exception &) {
+    }
+    return false;
+  }
+  return true;
+}
+
+void Script::setLinesBefore(unsigned count) { impl->linesBefore = count; }
+
+void Script::setInputName(const std::string &name) { impl->inputName = name; }
+
+bool Script::run(const std::string &input, std::string *output,
+                 std::string *error) {
+  size_t next = 0;
+  auto read = [&input, &next](std::string &line) {
+    if (next >= input.size()) {
+      return false;
+    }
+    auto end = input.find('\n', next);
+    if (end == std::string::npos) {
+      end = input.size();
+    }
+    line.assign(input, next, end - next);
+    next = end + 1;
+    return true;
+  };
+  auto write = [output](const char *text, size_t length) {
+    output->append(text, length);
+  };
+  return run(read, write, error);
+}
+}
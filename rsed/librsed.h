@@ -0,0 +1,57 @@
+//
+//  librsed.h
+//  rsed
+//
+
+#ifndef librsed_h
+#define librsed_h
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The rsed library: a script is compiled once and may then be run any
+// number of times over in-memory text or line callbacks, without temp
+// files or a process per run.
+//
+// Each Script has its own symbols, files and regular expressions, so
+// different scripts may run concurrently on different threads; a single
+// Script runs on one thread at a time.
+namespace rsed {
+
+class Script {
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+  Script();
+
+public:
+  ~Script();
+
+  // stores the next input line (without its '\n') and returns true, or
+  // returns false at end of input
+  typedef std::function<bool(std::string &)> ReadLine;
+  // receives the output as it is written; lines end in '\n'
+  typedef std::function<void(const char *, size_t)> WriteText;
+
+  // parse and optimize the text of a script, whose arguments are $ARG1,
+  // $ARG2,... Returns null, with the syntax errors in 'errors', if the
+  // script is invalid.
+  static std::unique_ptr<Script>
+  compile(const std::string &text, std::string *errors,
+          const std::vector<std::string> &args = {});
+
+  // run the script from its initial state; returns false, with the
+  // error message in 'error', if the script fails
+  bool run(ReadLine read, WriteText write, std::string *error);
+  // run over the lines of 'input', appending the output to 'output'
+  bool run(const std::string &input, std::string *output, std::string *error);
+  // for runs over a part of a larger input: the number of lines before
+  // it, so $LINE and error messages count from the start of the input
+  void setLinesBefore(unsigned count);
+  // the name of the input in messages, "<input>" by default
+  void setInputName(const std::string &name);
+};
+}
+
+#endif /* librsed_h */
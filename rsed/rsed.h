@@ -1,18 +0,0 @@
-//
-//  rsed.h
-//  rsed
-//
-//  Created by David Callahan on 6/25/15.
-//  Copyright (c) 2015 David Callahan. All rights reserved.
-//
-
-#ifndef rsed_rsed_h
-#define rsed_rsed_h
-#include <fstream>
-namespace  RSED {
-  extern std::ofstream env_save;
-  extern int debug;
-  extern int dump;
-}
-
-#endif
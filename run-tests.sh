@@ -11,8 +11,16 @@ set -e
 (mkdir -p build && cd build && cmake $MSAN ../rsed && make -j 8)
 set +e
 
+# -aot: also run each test as a script compiled with -emit_cpp
+AOT=0
+if [ "$1" == "-aot" ]
+then
+    AOT=1
+fi
+
 cd tests
 RSED=`pwd`/../build/rsed
+RUN=$RSED
 failed=0
 export ENV1=1
 export ENV2="ENV2 value"
@@ -26,9 +34,9 @@ runTest () {
     fi
     if [ -z "INPUT_ARG" ]
     then
-	ARG1=x ARG2=y $RSED $test $OPT $DEBUG a  < $input > $base.test-out 2> $base.test-err
+	ARG1=x ARG2=y $RUN ${SCRIPT-$test} $OPT $DEBUG a  < $input > $base.test-out 2> $base.test-err
     else
-	ARG1=x ARG2=y $RSED $test $OPT $DEBUG a -input=$input > $base.test-out 2> $base.test-err
+	ARG1=x ARG2=y $RUN ${SCRIPT-$test} $OPT $DEBUG a -input=$input > $base.test-out 2> $base.test-err
     fi
 }
 
@@ -92,6 +100,29 @@ do
     OPT=-optimize runPass
 done
 
+if [ $AOT == 1 ]
+then
+    mkdir -p ../build/aot
+    for test in test*.rsed
+    do
+        base=`basename $test .rsed`
+        for EMIT in -optimize=false -optimize
+        do
+            aot=../build/aot/$base$EMIT
+            $RSED $test $EMIT -emit_cpp=$aot.cpp &&
+                sh ../build/rsed-aot.sh $aot.cpp $aot
+            if [ $? != 0 ]
+            then
+                echo "compile failed" $test $EMIT
+                failed=1
+                continue
+            fi
+            RUN=$aot SCRIPT= OPT=$EMIT runPass
+        done
+    done
+    RUN=$RSED
+fi
+
 echo "test1 from stdin"
 base=test1
 cat $base.rsed | $RSED -script_in -input=$base.in > $base.test-out